@@ -36,6 +36,8 @@
 #define two17   131072.0
 #define two53   9007199254740992.0
 #define fact  5.9604644775390625e-8    /* 1 / 2^24 */
+#define invm1 (1.0 / m1)
+#define invm2 (1.0 / m2)
 
 
 
@@ -213,33 +215,143 @@ static void MatPowModM (double A[3][3], double B[3][3], double m, long n)
 
 /*-------------------------------------------------------------------------*/
 
-static double U01 (RngStream g)
+/* Advance the state s by one step and return the uniform, before applying Anti.
+   The quotients are taken by multiplying with 1/m, which can be off by one, so 
+   the remainders are corrected on both sides. */
+static inline double NextU01 (double s[6])
 {
    long k;
-   double p1, p2, u;
+   double p1, p2;
 
    /* Component 1 */
-   p1 = a12 * g->Cg[1] - a13n * g->Cg[0];
-   k = p1 / m1;
+   p1 = a12 * s[1] - a13n * s[0];
+   k = p1 * invm1;
    p1 -= k * m1;
    if (p1 < 0.0)
       p1 += m1;
-   g->Cg[0] = g->Cg[1];
-   g->Cg[1] = g->Cg[2];
-   g->Cg[2] = p1;
+   else if (p1 >= m1)
+      p1 -= m1;
+   s[0] = s[1];
+   s[1] = s[2];
+   s[2] = p1;
 
    /* Component 2 */
-   p2 = a21 * g->Cg[5] - a23n * g->Cg[3];
-   k = p2 / m2;
+   p2 = a21 * s[5] - a23n * s[3];
+   k = p2 * invm2;
    p2 -= k * m2;
    if (p2 < 0.0)
       p2 += m2;
-   g->Cg[3] = g->Cg[4];
-   g->Cg[4] = g->Cg[5];
-   g->Cg[5] = p2;
+   else if (p2 >= m2)
+      p2 -= m2;
+   s[3] = s[4];
+   s[4] = s[5];
+   s[5] = p2;
 
    /* Combination */
-   u = ((p1 > p2) ? (p1 - p2) * norm : (p1 - p2 + m1) * norm);
+   return ((p1 > p2) ? (p1 - p2) * norm : (p1 - p2 + m1) * norm);
+}
+
+#if RNGSTREAM_BUFFER_SIZE
+/*-------------------------------------------------------------------------*/
+
+#define ModM(p, m, invm)   \
+   k = (p) * (invm);         \
+   (p) -= k * (m);           \
+   if ((p) < 0.0)            \
+      (p) += (m);            \
+   else if ((p) >= (m))      \
+      (p) -= (m);
+
+/* Same as calling NextU01 RNGSTREAM_BUFFER_SIZE times. Three steps are done per 
+   iteration: the first two steps of component 1 do not depend on each other, so 
+   they, and the steps of the two components, can overlap in the CPU. */
+static void FillBuffer (RngStream g)
+{
+   int i;
+   long k;
+   double x0, x1, x2, y0, y1, y2;
+   double p1, q1, r1, p2, q2, r2;
+
+   for (i = 0; i < 6; ++i)
+      g->Fg[i] = g->Cg[i];
+   x0 = g->Cg[0];
+   x1 = g->Cg[1];
+   x2 = g->Cg[2];
+   y0 = g->Cg[3];
+   y1 = g->Cg[4];
+   y2 = g->Cg[5];
+   for (i = 0; i < RNGSTREAM_BUFFER_SIZE; i += 3) {
+      p1 = a12 * x1 - a13n * x0;
+      ModM (p1, m1, invm1)
+      q1 = a12 * x2 - a13n * x1;
+      ModM (q1, m1, invm1)
+      r1 = a12 * p1 - a13n * x2;
+      ModM (r1, m1, invm1)
+      p2 = a21 * y2 - a23n * y0;
+      ModM (p2, m2, invm2)
+      q2 = a21 * p2 - a23n * y1;
+      ModM (q2, m2, invm2)
+      r2 = a21 * q2 - a23n * y2;
+      ModM (r2, m2, invm2)
+      g->buffer[i] = (p1 > p2) ? (p1 - p2) * norm : (p1 - p2 + m1) * norm;
+      g->buffer[i + 1] = (q1 > q2) ? (q1 - q2) * norm : (q1 - q2 + m1) * norm;
+      g->buffer[i + 2] = (r1 > r2) ? (r1 - r2) * norm : (r1 - r2 + m1) * norm;
+      x0 = p1;
+      x1 = q1;
+      x2 = r1;
+      y0 = p2;
+      y1 = q2;
+      y2 = r2;
+   }
+   g->Cg[0] = x0;
+   g->Cg[1] = x1;
+   g->Cg[2] = x2;
+   g->Cg[3] = y0;
+   g->Cg[4] = y1;
+   g->Cg[5] = y2;
+   g->N_buffered = RNGSTREAM_BUFFER_SIZE;
+   g->N_used = 0;
+}
+
+/*-------------------------------------------------------------------------*/
+
+/* Set Cg to the state after the last uniform returned, and empty the buffer */
+static void SyncBuffer (RngStream g)
+{
+   int i;
+   if (g->N_buffered == 0)
+      return;
+   for (i = 0; i < 6; ++i)
+      g->Cg[i] = g->Fg[i];
+   for (i = 0; i < g->N_used; ++i)
+      NextU01 (g->Cg);
+   g->N_buffered = g->N_used = 0;
+}
+
+/*-------------------------------------------------------------------------*/
+
+/* Empty the buffer when Cg is about to be overwritten */
+static void DiscardBuffer (RngStream g)
+{
+   g->N_buffered = g->N_used = 0;
+}
+#else
+#define SyncBuffer(g)
+#define DiscardBuffer(g)
+#endif
+
+/*-------------------------------------------------------------------------*/
+
+static double U01 (RngStream g)
+{
+   double u;
+#if RNGSTREAM_BUFFER_SIZE
+   if (g->N_used == g->N_buffered)
+      FillBuffer (g);
+   u = g->buffer[g->N_used++];
+#else
+   u = NextU01 (g->Cg);
+#endif
    return (g->Anti) ? (1 - u) : u;
 }
 
@@ -326,6 +438,7 @@ RngStream RngStream_CreateStream (const char name[])
       g->name = 0;
    g->Anti = 0;
    g->IncPrec = 0;
+   DiscardBuffer (g);
 
    for (i = 0; i < 6; ++i) {
       g->Bg[i] = g->Cg[i] = g->Ig[i] = nextSeed[i];
@@ -352,6 +465,7 @@ void RngStream_DeleteStream (RngStream * p)
 void RngStream_ResetStartStream (RngStream g)
 {
    int i;
+   DiscardBuffer (g);
    for (i = 0; i < 6; ++i)
       g->Cg[i] = g->Bg[i] = g->Ig[i];
 }
@@ -361,6 +475,7 @@ void RngStream_ResetStartStream (RngStream g)
 void RngStream_ResetNextSubstream (RngStream g)
 {
    int i;
+   DiscardBuffer (g);
    MatVecModM (A1p76, g->Bg, g->Bg, m1);
    MatVecModM (A2p76, &g->Bg[3], &g->Bg[3], m2);
    for (i = 0; i < 6; ++i)
@@ -372,6 +487,7 @@ void RngStream_ResetNextSubstream (RngStream g)
 void RngStream_ResetStartSubstream (RngStream g)
 {
    int i;
+   DiscardBuffer (g);
    for (i = 0; i < 6; ++i)
       g->Cg[i] = g->Bg[i];
 }
@@ -395,6 +511,7 @@ int RngStream_SetSeed (RngStream g, unsigned long seed[6])
    int i;
    if (CheckSeed (seed))
       return -1;                    /* FAILURE */
+   DiscardBuffer (g);
    for (i = 0; i < 6; ++i)
       g->Cg[i] = g->Bg[i] = g->Ig[i] = seed[i];
    return 0;                       /* SUCCESS */ 
@@ -406,6 +523,7 @@ void RngStream_AdvanceState (RngStream g, long e, long c)
 {
    double B1[3][3], C1[3][3], B2[3][3], C2[3][3];
 
+   SyncBuffer (g);
    if (e > 0) {
       MatTwoPowModM (A1p0, B1, m1, e);
       MatTwoPowModM (A2p0, B2, m2, e);
@@ -436,6 +554,7 @@ void RngStream_AdvanceState (RngStream g, long e, long c)
 void RngStream_GetState (RngStream g, unsigned long seed[6])
 {
    int i;
+   SyncBuffer (g);
    for (i = 0; i < 6; ++i)
       seed[i] = g->Cg[i];
 }
@@ -447,6 +566,7 @@ void RngStream_WriteState (RngStream g)
    int i;
    if (g == NULL)
       return;
+   SyncBuffer (g);
    printf ("The current state of the Rngstream");
    if (g->name && (strlen (g->name) > 0))
       printf (" %s", g->name);
@@ -465,6 +585,7 @@ void RngStream_WriteStateFull (RngStream g)
    int i;
    if (g == NULL)
       return;
+   SyncBuffer (g);
    printf ("The RngStream");
    if (g->name && (strlen (g->name) > 0))
       printf (" %s", g->name);
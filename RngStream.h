@@ -3,6 +3,13 @@
 #ifndef RNGSTREAM_H
 #define RNGSTREAM_H
 
+/* Number of uniforms a stream generates ahead in one block (a multiple of 3). 0 generates 
+   them one at a time. Either way, a stream returns the same numbers and reports the same state. */
+#define RNGSTREAM_BUFFER_SIZE 96
+#if RNGSTREAM_BUFFER_SIZE % 3 != 0
+#error "RNGSTREAM_BUFFER_SIZE must be a multiple of 3"
+#endif
+
 
 typedef struct RngStream_InfoState * RngStream;
 
@@ -11,6 +18,12 @@ struct RngStream_InfoState {
    int Anti;
    int IncPrec;
    char *name;
+#if RNGSTREAM_BUFFER_SIZE
+   double buffer[RNGSTREAM_BUFFER_SIZE];  /* uniforms generated ahead, before applying Anti */
+   double Fg[6];                          /* state before the buffer was filled */
+   int N_buffered;
+   int N_used;
+#endif
 };
 
 
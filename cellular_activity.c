@@ -23,6 +23,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
+#include <string.h>
 #include "cellular_activity.h"
 #include "lib.h"
 #include "numerical.h"
@@ -45,6 +46,7 @@ static const float MAX_INT_TO_ACT_RATE=3.3;
 static const float BASAL_INT_TO_ACT_RATE=0.025;
 static const float DEFAULT_UPDATE_INTERVAL=10.0; /*min*/
 static const float MAX_TOLERABLE_CHANGE_IN_PROBABILITY_OF_BINDING=0.01;
+static const float MEAN_FIELD_DT=0.1; /*min, time step of the mean-field model*/
 
 /*fitness*/
 static const float Ne_saturate = 10000.0;
@@ -58,12 +60,18 @@ static const float bmax=1.0;
  *****************************************************************************/
 static float calc_tprime(Genotype*, CellState*, float*, float, float, int);
 
-static float calc_integral(Genotype *, CellState *, float *, float, float);
+static float calc_integral(Genotype *, CellState *, float *, float, float, float *);
 
+#if !CLOSED_FORM_TPRIME
 static void calc_fx_dfx(float, int, float, float*, float*, float*, float*, float*);
+#endif
 
 static void calc_leaping_interval(Genotype*, CellState*, float *, float, int);
 
+#if CLOSED_FORM_TPRIME
+static float calc_leaping_interval_single_copy(Genotype *, CellState *, int, float, float, float);
+#endif
+
 static void calc_TF_dist_from_all_BS(Genotype *, CellState*, int);
 
 static int Gillespie_event_mRNA_decay(GillespieRates *, CellState *, Genotype *, RngStream);
@@ -86,12 +94,30 @@ static int does_fixed_event_end(CellState*, float);
 
 static int do_fixed_event(Genotype *, CellState *, GillespieRates *, Environment *, Phenotype *, float *, int);
 
-static float calc_fitness(float *, Genotype *, CellState *, float*, float);
+static float calc_fitness(float *, Genotype *, CellState *, float*, float*, float);
 
 static void update_protein_number_and_fitness(Genotype *, CellState *, GillespieRates *, float);
 
+static void calc_cost_of_expression(Genotype *, CellState *);
+
+static void update_cost_of_expression(Genotype *, CellState *, int);
+
+static void sum_cost_of_expression(Genotype *, CellState *);
+
+#if FAST_EXP
+static inline float fast_exp(float);
+#endif
+
 static int do_Gillespie_event(Genotype*, CellState *, GillespieRates *, float, RngStream);
 
+static void set_mean_field_signal(Environment *, float, float, float *, char *);
+
+#if TAU_LEAPING
+static int do_leaping_timestep(Genotype *, CellState *, GillespieRates *, Environment *, float, Phenotype *, RngStream);
+
+static void leap_promoter(Genotype *, CellState *, int, float, RngStream);
+#endif
+
 
 
 /******************************************************************************
@@ -122,23 +148,23 @@ void initialize_cell(   Genotype *genotype,
     state->mRNA_transcr_time_end_tail = NULL;
     state->mRNA_transl_init_time_end_head = NULL;
     state->mRNA_transl_init_time_end_tail = NULL;
-    state->signal_off_head = NULL;
-    state->signal_off_tail = NULL;
-    state->signal_on_head = NULL;
-    state->signal_on_tail = NULL;
     state->burn_in_growth_rate_head =NULL;
     state->burn_in_growth_rate_tail=NULL;
     state->sampling_point_end_head=NULL;
     state->sampling_point_end_tail=NULL;
     state->last_event_t=0.0;  
-    state->change_signal_strength_head=NULL;
-    state->change_signal_strength_tail=NULL;
+    state->signal_schedule=NULL; //set by set_signal
+    state->t_next_signal_off=TIME_INFINITY;
+    state->t_next_signal_on=TIME_INFINITY;
+    state->t_next_signal_change=TIME_INFINITY;
     state->t_to_update_probability_of_binding=TIME_INFINITY;
     state->cell_activated=0;
     /*initialize gene state, mRNA number*/
     for (i=N_SIGNAL_TF; i < genotype->ngenes; i++) 
     {
-        state->transcriptional_state[i]=REPRESSED;       
+        state->N_promoters_in_state[i][REPRESSED]=genotype->N_copies[i];       
+        state->N_promoters_in_state[i][INTERMEDIATE]=0;
+        state->N_promoters_in_state[i][ACTIVE]=0;
         state->mRNA_aft_transl_delay_num[i]=init_mRNA_number[i];
         state->mRNA_under_transl_delay_num[i]=0;
         state->mRNA_under_transc_num[i]=0;
@@ -165,6 +191,7 @@ void initialize_cell(   Genotype *genotype,
         state->mRNA_under_transl_delay_num[i]=0;
         state->gene_specific_protein_number[i]=0.0;
     }        
+    calc_cost_of_expression(genotype, state);
     /*mark when to start calculating average fitness*/
     if(t_burn_in!=0.0)
         add_fixed_event(-1,t_burn_in,&(state->burn_in_growth_rate_head),&(state->burn_in_growth_rate_tail)); 
@@ -251,34 +278,20 @@ void calc_all_rates(Genotype *genotype,
             }
         }
         
-        /* calc other rates*/
-        switch (state->transcriptional_state[i])
-        {
-            case REPRESSED:
-                rates->repressed_to_intermediate_rate[i]=state->P_A[i]*(MAX_REP_TO_INT_RATE-BASAL_REP_TO_INT_RATE)+BASAL_REP_TO_INT_RATE;             
-                rates->total_repressed_to_intermediate_rate+=rates->repressed_to_intermediate_rate[i];
-                rates->intermediate_to_repressed_rate[i]=0.0;
-                rates->intermediate_to_active_rate[i]=0.0;
-                rates->active_to_intermediate_rate[i]=0.0;
-                break;                
-            case INTERMEDIATE:
-                rates->intermediate_to_repressed_rate[i]=state->P_R[i]*(MAX_INT_TO_REP_RATE-BASAL_INT_TO_REP_RATE)+BASAL_INT_TO_REP_RATE;
-                rates->total_intermediate_to_repressed_rate+=rates->intermediate_to_repressed_rate[i];
-                rates->intermediate_to_active_rate[i]=MAX_INT_TO_ACT_RATE*state->P_A_no_R[i]+BASAL_INT_TO_ACT_RATE*state->P_NotA_no_R[i];
-                rates->total_intermediate_to_active_rate+=rates->intermediate_to_active_rate[i]; 
-                rates->active_to_intermediate_rate[i]=0.0;
-                rates->repressed_to_intermediate_rate[i]=0.0;
-                break;                
-            case ACTIVE: 
-                rates->active_to_intermediate_rate[i]=genotype->active_to_intermediate_rate[i];
-                rates->total_active_to_intermediate_rate+=rates->active_to_intermediate_rate[i]; 
-                rates->transcript_initiation_state[i]= 1;
-                rates->total_N_gene_transcript_initiated+=1;
-                rates->intermediate_to_repressed_rate[i]=0.0; 
-                rates->repressed_to_intermediate_rate[i]=0.0;
-                rates->intermediate_to_active_rate[i]=0.0;
-                break;
-        }
+        /* calc other rates. Each copy of the gene contributes the rates of the state of its promoter*/
+        rates->repressed_to_intermediate_rate[i]=(float)state->N_promoters_in_state[i][REPRESSED]*
+                                                    (state->P_A[i]*(MAX_REP_TO_INT_RATE-BASAL_REP_TO_INT_RATE)+BASAL_REP_TO_INT_RATE);             
+        rates->total_repressed_to_intermediate_rate+=rates->repressed_to_intermediate_rate[i];
+        rates->intermediate_to_repressed_rate[i]=(float)state->N_promoters_in_state[i][INTERMEDIATE]*
+                                                    (state->P_R[i]*(MAX_INT_TO_REP_RATE-BASAL_INT_TO_REP_RATE)+BASAL_INT_TO_REP_RATE);
+        rates->total_intermediate_to_repressed_rate+=rates->intermediate_to_repressed_rate[i];
+        rates->intermediate_to_active_rate[i]=(float)state->N_promoters_in_state[i][INTERMEDIATE]*
+                                                    (MAX_INT_TO_ACT_RATE*state->P_A_no_R[i]+BASAL_INT_TO_ACT_RATE*state->P_NotA_no_R[i]);
+        rates->total_intermediate_to_active_rate+=rates->intermediate_to_active_rate[i]; 
+        rates->active_to_intermediate_rate[i]=(float)state->N_promoters_in_state[i][ACTIVE]*genotype->active_to_intermediate_rate[i];
+        rates->total_active_to_intermediate_rate+=rates->active_to_intermediate_rate[i]; 
+        rates->transcript_initiation_state[i]=state->N_promoters_in_state[i][ACTIVE];
+        rates->total_N_gene_transcript_initiated+=rates->transcript_initiation_state[i];
     }
     rates->total_Gillespie_rate+=rates->total_intermediate_to_repressed_rate;
     rates->total_Gillespie_rate+=rates->total_intermediate_to_active_rate;
@@ -355,6 +368,10 @@ void do_single_timestep(Genotype *genotype,
     float x; 
     float developmental_time=env->t_development+t_burn_in;
     
+#if TAU_LEAPING
+    if(do_leaping_timestep(genotype, state, rates, env, t_burn_in, timecourse, RS))
+        return;
+#endif
     /* draw random number */
     x = expdev(RS);       
     dt = x/rates->total_Gillespie_rate;    
@@ -408,6 +425,329 @@ void do_single_timestep(Genotype *genotype,
 }
 
 
+#if TAU_LEAPING
+/*
+ * A hybrid timestep. Genes whose promoter in its current state changes state or initiates
+ * transcription at a total rate of at least TAU_LEAPING_MIN_RATE are fast. The remaining 
+ * (slow) Gillespie events, which include all mRNA decay, and fixed events are still done 
+ * one at a time, but between two of them each fast promoter is simulated on its own, 
+ * without recalculating the rates of all events after each of its transitions. Pact and 
+ * Prep of fast genes are frozen in between; they change by at most 
+ * MAX_TOLERABLE_CHANGE_IN_PROBABILITY_OF_BINDING before a mandatory update (a fixed event). 
+ * A leap is also no longer than the shortest transcription of a fast gene, so that the 
+ * transcriptions initiated during a leap end after it.
+ * Return 0 without doing anything if no gene is fast.
+ */
+static int do_leaping_timestep(Genotype *genotype, 
+                                CellState *state,                         
+                                GillespieRates *rates,                        
+                                Environment *env,  
+                                float t_burn_in,
+                                Phenotype *timecourse,
+                                RngStream RS) 
+{
+    int i, event, UPDATE_WHAT, N_fast_genes, slow_event, end_of_development;
+    int is_fast[MAX_GENES];
+    float dt, rate, max_leap, transcription_time;
+    float developmental_time=env->t_development+t_burn_in;
+    
+    /* partition genes into fast and slow */
+    N_fast_genes=0;
+    max_leap=TIME_INFINITY;
+    for(i=N_SIGNAL_TF;i<genotype->ngenes;i++)
+    {
+        rate=rates->repressed_to_intermediate_rate[i]+rates->intermediate_to_repressed_rate[i]+rates->intermediate_to_active_rate[i]+
+                rates->active_to_intermediate_rate[i]+(float)rates->transcript_initiation_state[i]*TRANSCRIPTINIT;
+        is_fast[i]=(rate>=TAU_LEAPING_MIN_RATE);
+        if(is_fast[i])
+        {
+            N_fast_genes++;
+            transcription_time=(float)genotype->locus_length[i]/TRANSCRIPTION_ELONGATION_RATE+TRANSCRIPTION_TERMINATION_TIME;
+            max_leap=(max_leap<transcription_time)?max_leap:transcription_time;
+            /* remove the events of fast genes from the Gillespie events */
+            rates->repressed_to_intermediate_rate[i]=0.0;
+            rates->intermediate_to_repressed_rate[i]=0.0;
+            rates->intermediate_to_active_rate[i]=0.0;
+            rates->active_to_intermediate_rate[i]=0.0;
+            rates->transcript_initiation_state[i]=0;
+        }
+    }
+    if(N_fast_genes==0)
+        return 0;
+    /* sum up the rates of slow events. Sum from scratch, so that a category without slow events has a total rate of exactly 0 */
+    rates->total_active_to_intermediate_rate=0.0;
+    rates->total_repressed_to_intermediate_rate=0.0;
+    rates->total_intermediate_to_repressed_rate=0.0;
+    rates->total_intermediate_to_active_rate=0.0;
+    rates->total_N_gene_transcript_initiated=0;
+    for(i=N_SIGNAL_TF;i<genotype->ngenes;i++)
+    {
+        rates->total_active_to_intermediate_rate+=rates->active_to_intermediate_rate[i];
+        rates->total_repressed_to_intermediate_rate+=rates->repressed_to_intermediate_rate[i];
+        rates->total_intermediate_to_repressed_rate+=rates->intermediate_to_repressed_rate[i];
+        rates->total_intermediate_to_active_rate+=rates->intermediate_to_active_rate[i];
+        rates->total_N_gene_transcript_initiated+=rates->transcript_initiation_state[i];
+    }
+    rates->total_Gillespie_rate=0.0;
+    rates->total_Gillespie_rate+=rates->total_intermediate_to_repressed_rate;
+    rates->total_Gillespie_rate+=rates->total_intermediate_to_active_rate;
+    rates->total_Gillespie_rate+=rates->total_repressed_to_intermediate_rate;
+    rates->total_Gillespie_rate+=rates->total_mRNA_decay_rate;
+    rates->total_Gillespie_rate+=rates->total_active_to_intermediate_rate;
+    rates->total_Gillespie_rate+=(float)rates->total_N_gene_transcript_initiated*TRANSCRIPTINIT;  
+    
+    /* time to the next slow event, or to the end of the leap */
+    dt=(rates->total_Gillespie_rate>0.0)?expdev(RS)/rates->total_Gillespie_rate:TIME_INFINITY;
+    slow_event=(dt<max_leap);
+    dt=slow_event?dt:max_leap;
+    end_of_development=(state->t+dt>=developmental_time);
+    if(end_of_development)
+        dt=developmental_time-state->t;
+    event=does_fixed_event_end(state, state->t+dt);
+    if(event!=0) /* a fixed event comes first. It resets dt to the time till the event */
+    {
+        UPDATE_WHAT=do_fixed_event(genotype, state, rates, env, timecourse, &dt, event);
+        for(i=N_SIGNAL_TF;i<genotype->ngenes;i++)
+            if(is_fast[i])
+                leap_promoter(genotype, state, i, dt, RS);
+        state->t+=dt;
+        calc_all_rates(genotype, state, rates, env, timecourse, t_burn_in, UPDATE_WHAT);
+        return 1;
+    }
+    /* fast promoters, then proteins and fitness, run till the end of dt */
+    for(i=N_SIGNAL_TF;i<genotype->ngenes;i++)
+        if(is_fast[i])
+            leap_promoter(genotype, state, i, dt, RS);
+    update_protein_number_and_fitness(genotype, state, rates, dt);
+    if(end_of_development)
+    {
+        state->t=developmental_time;
+        return 1;
+    }
+    UPDATE_WHAT=DO_NOTHING;
+    if(slow_event) /* a slow event ends dt */
+        UPDATE_WHAT=do_Gillespie_event(genotype, state, rates, dt, RS);
+    state->t+=dt;
+    calc_all_rates(genotype, state, rates, env, timecourse, t_burn_in, UPDATE_WHAT);
+    return 1;
+}
+
+/*
+ * Simulate the promoters of (the copies of) a gene from state->t to state->t+dt, with Pact and Prep 
+ * of the gene fixed. Transcription initiated at time t ends at t+transcription_time as in 
+ * Gillespie_event_transcription_init.
+ */
+static void leap_promoter(Genotype *genotype, CellState *state, int gene_id, float dt, RngStream RS)
+{
+    float t, x, total_rate;
+    float rate_R_to_I, rate_I_to_R, rate_I_to_A, rate_A_to_I, rate_transcription_init;
+    float rate_R_to_I_per_copy, rate_I_to_R_per_copy, rate_I_to_A_per_copy;
+    float candidate_t, transcription_time;
+    int concurrent;
+    int *N_promoters=&(state->N_promoters_in_state[gene_id][0]);
+    
+    rate_R_to_I_per_copy=state->P_A[gene_id]*(MAX_REP_TO_INT_RATE-BASAL_REP_TO_INT_RATE)+BASAL_REP_TO_INT_RATE;
+    rate_I_to_R_per_copy=state->P_R[gene_id]*(MAX_INT_TO_REP_RATE-BASAL_INT_TO_REP_RATE)+BASAL_INT_TO_REP_RATE;
+    rate_I_to_A_per_copy=MAX_INT_TO_ACT_RATE*state->P_A_no_R[gene_id]+BASAL_INT_TO_ACT_RATE*state->P_NotA_no_R[gene_id];
+    transcription_time=(float)genotype->locus_length[gene_id]/TRANSCRIPTION_ELONGATION_RATE+TRANSCRIPTION_TERMINATION_TIME;
+    t=0.0;
+    while(1)
+    {
+        rate_R_to_I=(float)N_promoters[REPRESSED]*rate_R_to_I_per_copy;
+        rate_I_to_R=(float)N_promoters[INTERMEDIATE]*rate_I_to_R_per_copy;
+        rate_I_to_A=(float)N_promoters[INTERMEDIATE]*rate_I_to_A_per_copy;
+        rate_A_to_I=(float)N_promoters[ACTIVE]*genotype->active_to_intermediate_rate[gene_id];
+        rate_transcription_init=(float)N_promoters[ACTIVE]*TRANSCRIPTINIT;
+        total_rate=rate_R_to_I+rate_I_to_R+rate_I_to_A+rate_A_to_I+rate_transcription_init;
+        if(total_rate<=0.0)
+            break;
+        t+=expdev(RS)/total_rate;
+        if(t>=dt)
+            break;
+        x=RngStream_RandU01(RS)*total_rate;
+        if(x<rate_transcription_init)
+        {
+            candidate_t=state->t+t+transcription_time;
+            concurrent=check_concurrence(state, candidate_t);
+            while(concurrent)//if the time to update overlaps with existing events, add a tiny offset
+            {
+                candidate_t+=TIME_OFFSET;
+                concurrent=check_concurrence(state, candidate_t);        
+            }    
+            add_fixed_event(gene_id, candidate_t,&(state->mRNA_transcr_time_end_head), &(state->mRNA_transcr_time_end_tail));
+            (state->mRNA_under_transc_num[gene_id])++;
+        }
+        else if((x-=rate_transcription_init)<rate_A_to_I && N_promoters[ACTIVE]>0)
+        {
+            N_promoters[ACTIVE]--;
+            N_promoters[INTERMEDIATE]++;
+        }
+        else if((x-=rate_A_to_I)<rate_R_to_I && N_promoters[REPRESSED]>0)
+        {
+            N_promoters[REPRESSED]--;
+            N_promoters[INTERMEDIATE]++;
+        }
+        else if(x-rate_R_to_I<rate_I_to_R && N_promoters[INTERMEDIATE]>0)
+        {
+            N_promoters[INTERMEDIATE]--;
+            N_promoters[REPRESSED]++;
+        }
+        else if(N_promoters[INTERMEDIATE]>0) /* intermediate to active, also the fallback of rounding errors */
+        {
+            N_promoters[INTERMEDIATE]--;
+            N_promoters[ACTIVE]++;
+        }
+    }
+}
+#endif
+
+/*
+ * A deterministic approximation of the fitness of a genotype in an environment.
+ * Gene states and mRNA numbers are replaced with their expected values, which change
+ * with the expected rates of the stochastic model, and the burn-in has a fixed duration.
+ * Transcriptional and translational delays are kept. The fitness is the time average of 
+ * the instantaneous fitness calculated from the expected protein numbers.
+ */
+float calc_mean_field_fitness(  Genotype *genotype,
+                                Environment *env,
+                                float t_burn_in,
+                                int init_mRNA_number[MAX_GENES],
+                                float init_protein_number[MAX_GENES])
+{
+    int i,j,cluster_id,head;
+    int N_steps,step,step_transcribed,step_translated;
+    float t,signal,Ne,total_translation_rate,instantaneous_fitness,last_instantaneous_fitness;
+    float integrated_fitness=0.0;
+    float k_RI,k_IR,k_IA,k_AI,a_R,a_A,ect,flux_transcribed,flux_translated;
+    float P_R[MAX_GENES],P_I[MAX_GENES],P_A[MAX_GENES];
+    float mRNA_aft_transl_delay[MAX_GENES],mRNA_under_transl_delay[MAX_GENES];
+    float survival_in_transl_delay[MAX_GENES];
+    int transcription_delay[MAX_GENES],translation_delay[MAX_GENES];
+    float *transcription_init_flux;
+    char effect_of_effector;
+    CellState state;
+
+    memset(&state,0,sizeof(CellState));
+    N_steps=(int)((env->t_development+t_burn_in)/MEAN_FIELD_DT)+1;
+    transcription_init_flux=(float *)malloc(genotype->ngenes*N_steps*sizeof(float));
+    
+    /*initialize gene states, mRNA and protein numbers as in initialize_cell*/
+    for(i=N_SIGNAL_TF;i<genotype->ngenes;i++)
+    {
+        P_R[i]=1.0;
+        P_I[i]=0.0;
+        P_A[i]=0.0;
+        mRNA_aft_transl_delay[i]=(float)init_mRNA_number[i];
+        mRNA_under_transl_delay[i]=0.0;
+        transcription_delay[i]=(int)(((float)genotype->locus_length[i]/TRANSCRIPTION_ELONGATION_RATE+TRANSCRIPTION_TERMINATION_TIME)/MEAN_FIELD_DT+0.5);
+        translation_delay[i]=(int)(((float)genotype->locus_length[i]/TRANSLATION_ELONGATION_RATE+TRANSLATION_INITIATION_TIME)/MEAN_FIELD_DT+0.5);
+        survival_in_transl_delay[i]=exp(-genotype->mRNA_decay_rate[i]*translation_delay[i]*MEAN_FIELD_DT);
+        state.gene_specific_protein_number[i]=init_protein_number[i];
+        state.protein_synthesis_index[i]=mRNA_aft_transl_delay[i]*genotype->translation_rate[i]/genotype->protein_decay_rate[i];
+    }
+    for(i=0;i<N_SIGNAL_TF;i++)
+    {
+        state.gene_specific_protein_number[i]=0.0;
+        state.protein_number[i]=0.0;
+    }
+    last_instantaneous_fitness=0.0;
+    
+    for(step=0;step<N_steps;step++)
+    {
+        t=step*MEAN_FIELD_DT;
+        
+        /*pool protein numbers and set the signal*/
+        for(i=N_SIGNAL_TF;i<genotype->nproteins;i++)
+        {
+            state.protein_number[i]=0.0;
+            for(j=0;j<genotype->protein_pool[i][0][0];j++)
+                state.protein_number[i]+=state.gene_specific_protein_number[genotype->protein_pool[i][1][j]];
+        }
+        set_mean_field_signal(env,t_burn_in,t,&signal,&effect_of_effector);
+        state.protein_number[N_SIGNAL_TF-1]=signal;
+#if N_SIGNAL_TF==2
+        state.protein_number[0]=background_signal_strength;
+#endif
+        
+        /*instantaneous fitness, as in calc_fitness*/
+        Ne=state.protein_number[genotype->nproteins-1];
+        total_translation_rate=0.0;
+        for(i=N_SIGNAL_TF;i<genotype->ngenes;i++)
+            total_translation_rate+=(genotype->translation_rate[i]*mRNA_aft_transl_delay[i]+
+                                    0.5*genotype->translation_rate[i]*mRNA_under_transl_delay[i])*(float)genotype->locus_length[i]/236.0;
+        switch(effect_of_effector)
+        {
+            case 'b':
+                instantaneous_fitness=(Ne<Ne_saturate)?bmax*Ne/Ne_saturate:bmax;
+                break;
+            case 'd':
+                instantaneous_fitness=(Ne<Ne_saturate)?bmax-bmax/Ne_saturate*Ne:0.0;
+                break;
+            default:
+                instantaneous_fitness=bmax;
+        }
+        instantaneous_fitness-=total_translation_rate*c_transl;
+        if(t>t_burn_in)
+            integrated_fitness+=0.5*(instantaneous_fitness+last_instantaneous_fitness)*MEAN_FIELD_DT;
+        last_instantaneous_fitness=instantaneous_fitness;
+        
+        /*probability of binding configurations*/
+        for(i=N_SIGNAL_TF;i<genotype->ngenes;i++)
+        {
+            cluster_id=genotype->which_cluster[i];
+            head=genotype->cisreg_cluster[cluster_id][0];
+            if(head!=i) 
+            {
+                state.P_A[i]=state.P_A[head];
+                state.P_R[i]=state.P_R[head];
+                state.P_A_no_R[i]=state.P_A_no_R[head];
+                state.P_NotA_no_R[i]=state.P_NotA_no_R[head];
+            }
+            else if(genotype->N_act_BS[i]!=0 || genotype->N_rep_BS[i]!=0)
+                calc_TF_dist_from_all_BS(genotype, &state, i);
+            else
+            {
+                state.P_A[i]=0.0;
+                state.P_R[i]=0.0;
+                state.P_A_no_R[i]=0.0;
+                state.P_NotA_no_R[i]=0.0;
+            }
+        }
+        
+        /*advance gene states, mRNAs, and proteins by MEAN_FIELD_DT*/
+        for(i=N_SIGNAL_TF;i<genotype->ngenes;i++)
+        {
+            k_RI=state.P_A[i]*(MAX_REP_TO_INT_RATE-BASAL_REP_TO_INT_RATE)+BASAL_REP_TO_INT_RATE;
+            k_IR=state.P_R[i]*(MAX_INT_TO_REP_RATE-BASAL_INT_TO_REP_RATE)+BASAL_INT_TO_REP_RATE;
+            k_IA=MAX_INT_TO_ACT_RATE*state.P_A_no_R[i]+BASAL_INT_TO_ACT_RATE*state.P_NotA_no_R[i];
+            k_AI=genotype->active_to_intermediate_rate[i];
+            /*backward Euler, because the transitions can be much faster than MEAN_FIELD_DT*/
+            a_R=1.0/(1.0+MEAN_FIELD_DT*k_RI);
+            a_A=1.0/(1.0+MEAN_FIELD_DT*k_AI);
+            P_I[i]=(P_I[i]+MEAN_FIELD_DT*k_RI*a_R*P_R[i]+MEAN_FIELD_DT*k_AI*a_A*P_A[i])/
+                    (1.0+MEAN_FIELD_DT*k_IR*(1.0-MEAN_FIELD_DT*k_RI*a_R)+MEAN_FIELD_DT*k_IA*(1.0-MEAN_FIELD_DT*k_AI*a_A));
+            P_R[i]=a_R*(P_R[i]+MEAN_FIELD_DT*k_IR*P_I[i]);
+            P_A[i]=a_A*(P_A[i]+MEAN_FIELD_DT*k_IA*P_I[i]);
+            
+            /*mRNAs finish transcription and translation initiation after fixed delays*/
+            transcription_init_flux[i*N_steps+step]=TRANSCRIPTINIT*P_A[i];
+            step_transcribed=step-transcription_delay[i];
+            step_translated=step_transcribed-translation_delay[i];
+            flux_transcribed=(step_transcribed>=0)?transcription_init_flux[i*N_steps+step_transcribed]:0.0;
+            flux_translated=(step_translated>=0)?transcription_init_flux[i*N_steps+step_translated]*survival_in_transl_delay[i]:0.0;
+            ect=exp(-genotype->mRNA_decay_rate[i]*MEAN_FIELD_DT);
+            mRNA_under_transl_delay[i]=ect*mRNA_under_transl_delay[i]+(flux_transcribed-flux_translated)*(1.0-ect)/genotype->mRNA_decay_rate[i];
+            mRNA_aft_transl_delay[i]=ect*mRNA_aft_transl_delay[i]+flux_translated*(1.0-ect)/genotype->mRNA_decay_rate[i];
+            
+            /*proteins are updated as in update_protein_number_and_fitness*/
+            state.gene_specific_protein_number[i]=exp(-genotype->protein_decay_rate[i]*MEAN_FIELD_DT)*(state.gene_specific_protein_number[i]-state.protein_synthesis_index[i])+
+                                                    state.protein_synthesis_index[i];
+            state.protein_synthesis_index[i]=mRNA_aft_transl_delay[i]*genotype->translation_rate[i]/genotype->protein_decay_rate[i];
+        }
+    }
+    free(transcription_init_flux);
+    return integrated_fitness/env->t_development;
+}
 
 /*****************************************************************************
  * 
@@ -424,6 +764,29 @@ static float calc_tprime(Genotype *genotype, CellState* state, float *number_of_
     int n_copies;
     int i;          
     n_copies=genotype->protein_pool[protein_id][0][0];
+#if CLOSED_FORM_TPRIME
+    int gene_id;
+    float ratio;
+    float steady_state[n_copies],protein_decay_rate[n_copies];
+    if(n_copies==1) 
+    {
+        /* f(x)=(N0-Ns)exp(-kx)+Ns, where Ns is protein_synthesis_index */
+        gene_id=genotype->protein_pool[protein_id][1][0];
+        ratio=(given_amount-state->protein_synthesis_index[gene_id])/(number_of_selection_protein_bf_dt[0]-state->protein_synthesis_index[gene_id]);
+        if(ratio>=1.0)
+            return 0.0;
+        if(ratio>0.0)
+            return fminf(-log(ratio)/genotype->protein_decay_rate[gene_id],dt);
+        return dt; //also if ratio is nan
+    }
+    for(i=0;i<n_copies;i++)
+    {
+        gene_id=genotype->protein_pool[protein_id][1][i];
+        protein_decay_rate[i]=genotype->protein_decay_rate[gene_id];
+        steady_state[i]=state->protein_synthesis_index[gene_id];
+    }
+    return rtsafe_sum_of_exp(n_copies, given_amount, number_of_selection_protein_bf_dt, steady_state, protein_decay_rate, 0.0, dt);
+#else
     float protein_synthesis_rate[n_copies],protein_decay_rate[n_copies];
     for(i=0;i<n_copies;i++)
     {
@@ -431,8 +794,10 @@ static float calc_tprime(Genotype *genotype, CellState* state, float *number_of_
         protein_synthesis_rate[i]=state->protein_synthesis_index[genotype->protein_pool[protein_id][1][i]]*protein_decay_rate[i];
     }       
     return rtsafe(&calc_fx_dfx, n_copies, given_amount, number_of_selection_protein_bf_dt, protein_synthesis_rate, protein_decay_rate, 0.0, dt); 
+#endif
 }
 
+#if !CLOSED_FORM_TPRIME
 /*
  * calculate f(x)-Pp_s and f'(x),
  * f(x) is the number of effector protein molecules at time x
@@ -449,12 +814,14 @@ static void calc_fx_dfx(float x, int n_copies, float given_amount, float *intial
     }
     *fx-=given_amount;    
 }
+#endif
 
 /*
  * calculate F(delta_t)/Ne_sat. F(x) is the integral of f(x) over delta_t.
- * f(x) is the number of effector protein molecules at time x
+ * f(x) is the number of effector protein molecules at time x.
+ * If one_minus_ect is not NULL, it gives 1-exp(-protein_decay_rate*dt) of each copy of effector gene
  */
-static float calc_integral(Genotype *genotype, CellState *state, float *initial_protein_number, float dt, float saturate_protein_number)
+static float calc_integral(Genotype *genotype, CellState *state, float *initial_protein_number, float dt, float saturate_protein_number, float *one_minus_ect)
 {
     int i,n_copies,gene_ids[MAX_PROTEINS];
     float integral=0.0,ect_minus_one;    
@@ -465,7 +832,10 @@ static float calc_integral(Genotype *genotype, CellState *state, float *initial_
         
     for(i=0;i<n_copies;i++)
     {
-        ect_minus_one=exp(-genotype->protein_decay_rate[gene_ids[i]]*dt)-1.0;    
+        if(one_minus_ect!=NULL)
+            ect_minus_one=-one_minus_ect[i];
+        else
+            ect_minus_one=exp(-genotype->protein_decay_rate[gene_ids[i]]*dt)-1.0;    
         integral+=(state->protein_synthesis_index[gene_ids[i]]*ect_minus_one/genotype->protein_decay_rate[gene_ids[i]]-
                 initial_protein_number[i]*ect_minus_one/genotype->protein_decay_rate[gene_ids[i]]+ 
                 state->protein_synthesis_index[gene_ids[i]]*dt);
@@ -481,25 +851,17 @@ static float calc_fitness(float *integrated_fitness,
                             Genotype *genotype,
                             CellState *state,
                             float* number_of_selection_protein_bf_dt,
+                            float* one_minus_ect,
                             float dt)
 {
     int i;
     float instantaneous_fitness=0.0;  /* this is returned from the function */
-    float total_translation_rate = 0.0;    
     float dt_prime;   
-    float cost_of_expression;     
+    float cost_of_expression=state->cost_of_expression;     
     float Ne_next=state->protein_number[genotype->nproteins-1];   
     float Ne=0.0;
     for(i=0;i<genotype->protein_pool[genotype->nproteins-1][0][0];i++) 
        Ne+=number_of_selection_protein_bf_dt[i];
-                      
-    /* compute the total cost of translation across all genes  */
-    for(i=N_SIGNAL_TF; i < genotype->ngenes; i++)        
-    {     
-        total_translation_rate += (genotype->translation_rate[i]*(float)state->mRNA_aft_transl_delay_num[i]+
-                                    0.5*genotype->translation_rate[i]*(float)state->mRNA_under_transl_delay_num[i])*(float)genotype->locus_length[i]/236.0; //236 codon is the average length of yeast protein
-    }
-    cost_of_expression=total_translation_rate*c_transl;
 
     switch (state->effect_of_effector)
     {
@@ -512,14 +874,14 @@ static float calc_fitness(float *integrated_fitness,
                 }
                 else if(Ne<=Ne_saturate) // not enough effector throughout
                 {
-                    *integrated_fitness = bmax*calc_integral(genotype, state, number_of_selection_protein_bf_dt, dt, Ne_saturate)
+                    *integrated_fitness = bmax*calc_integral(genotype, state, number_of_selection_protein_bf_dt, dt, Ne_saturate, one_minus_ect)
                                             -cost_of_expression*dt;
                 }
                 else // bf dt_prime, the benefit saturates
                 {
                     dt_prime=calc_tprime(genotype,state,number_of_selection_protein_bf_dt,dt,Ne_saturate,genotype->nproteins-1); 
-                    *integrated_fitness = bmax*dt_prime+bmax*(calc_integral(genotype, state, number_of_selection_protein_bf_dt, dt, Ne_saturate)-
-                                                  calc_integral(genotype, state, number_of_selection_protein_bf_dt, dt_prime, Ne_saturate))-
+                    *integrated_fitness = bmax*dt_prime+bmax*(calc_integral(genotype, state, number_of_selection_protein_bf_dt, dt, Ne_saturate, one_minus_ect)-
+                                                  calc_integral(genotype, state, number_of_selection_protein_bf_dt, dt_prime, Ne_saturate, NULL))-
                                                     cost_of_expression*dt;                    
                 }                    
             }
@@ -531,13 +893,13 @@ static float calc_fitness(float *integrated_fitness,
                 }   
                 else if(Ne_next<=Ne_saturate)// not enough effector throughout
                 {
-                    *integrated_fitness = bmax*calc_integral(genotype, state, number_of_selection_protein_bf_dt, dt, Ne_saturate)
+                    *integrated_fitness = bmax*calc_integral(genotype, state, number_of_selection_protein_bf_dt, dt, Ne_saturate, one_minus_ect)
                                                     -cost_of_expression*dt;
                 }
                 else //Aft dt_prime, the benefit saturates
                 {
                     dt_prime=calc_tprime(genotype,state,number_of_selection_protein_bf_dt,dt,Ne_saturate,genotype->nproteins-1); 
-                    *integrated_fitness = bmax*(dt-dt_prime)+bmax*calc_integral(genotype, state, number_of_selection_protein_bf_dt, dt_prime, Ne_saturate)-
+                    *integrated_fitness = bmax*(dt-dt_prime)+bmax*calc_integral(genotype, state, number_of_selection_protein_bf_dt, dt_prime, Ne_saturate, NULL)-
                                                     cost_of_expression*dt;
                 }                
             } 
@@ -557,14 +919,14 @@ static float calc_fitness(float *integrated_fitness,
                 }
                 else if(Ne<=Ne_saturate) // not enough effector throughout
                 {
-                    *integrated_fitness = bmax*dt-bmax*calc_integral(genotype, state, number_of_selection_protein_bf_dt, dt, Ne_saturate)
+                    *integrated_fitness = bmax*dt-bmax*calc_integral(genotype, state, number_of_selection_protein_bf_dt, dt, Ne_saturate, one_minus_ect)
                                                     -cost_of_expression*dt;
                 }
                 else // aft dt_prime, the benefit becomes positive
                 {
                     dt_prime=calc_tprime(genotype,state,number_of_selection_protein_bf_dt,dt,Ne_saturate,genotype->nproteins-1); 
-                    *integrated_fitness = bmax*(dt-dt_prime)-bmax*(calc_integral(genotype, state, number_of_selection_protein_bf_dt, dt, Ne_saturate)-
-                                                  calc_integral(genotype, state, number_of_selection_protein_bf_dt, dt_prime, Ne_saturate))-
+                    *integrated_fitness = bmax*(dt-dt_prime)-bmax*(calc_integral(genotype, state, number_of_selection_protein_bf_dt, dt, Ne_saturate, one_minus_ect)-
+                                                  calc_integral(genotype, state, number_of_selection_protein_bf_dt, dt_prime, Ne_saturate, NULL))-
                                                     cost_of_expression*dt;                    
                 }                    
             }
@@ -576,13 +938,13 @@ static float calc_fitness(float *integrated_fitness,
                 }   
                 else if(Ne_next<=Ne_saturate)// not enough effector throughout
                 {
-                    *integrated_fitness = bmax*dt-bmax*calc_integral(genotype, state, number_of_selection_protein_bf_dt, dt, Ne_saturate)
+                    *integrated_fitness = bmax*dt-bmax*calc_integral(genotype, state, number_of_selection_protein_bf_dt, dt, Ne_saturate, one_minus_ect)
                                                     -cost_of_expression*dt;
                 }
                 else //Aft dt_prime, the benefit becomes zero
                 {
                     dt_prime=calc_tprime(genotype,state,number_of_selection_protein_bf_dt,dt,Ne_saturate,genotype->nproteins-1); 
-                    *integrated_fitness = bmax*dt_prime-bmax*calc_integral(genotype, state, number_of_selection_protein_bf_dt, dt_prime, Ne_saturate)-
+                    *integrated_fitness = bmax*dt_prime-bmax*calc_integral(genotype, state, number_of_selection_protein_bf_dt, dt_prime, Ne_saturate, NULL)-
                                                     cost_of_expression*dt;
                 }                
             } 
@@ -607,14 +969,16 @@ static void calc_TF_dist_from_all_BS(Genotype *genotype, CellState *state, int g
 {
     int max_N_binding_act=genotype->max_unhindered_sites[gene_id][1]+1; //Binding configurations can contain at most x activators, plus 1 type of configurations that don't have activators at all. 
     int max_N_binding_rep=genotype->max_unhindered_sites[gene_id][2]+1; //Binding configurations can contain at most y repressors, plus 1 type of configurations that don't have repressors at all. 
-    double ratio_matrices[genotype->binding_sites_num[gene_id]+1][max_N_binding_rep][max_N_binding_act]; 
+    int size_of_matrix=max_N_binding_rep*max_N_binding_act;
+    /* One matrix per BS, each stored as a flat array: element [i][j] (configurations with i repressors and j 
+     * activators bound) is at i*max_N_binding_act+j. Then shifting the matrix of BS n-H by one activator or by 
+     * one repressor is an offset of 1 or max_N_binding_act, and each BS is a single loop over the matrix.*/
+    double ratio_matrices[genotype->binding_sites_num[gene_id]*size_of_matrix]; 
+    double *matrix_n, *matrix_n_minus_1, *matrix_nH;
     double sum;    
     register double product_of_freq; 
     register float cache_Kd;
-    int pos_of_last_record;  
-    int pos_of_mat_nH;
-    int pos_next_record;
-    int i,j,m,n;
+    int i,j,k,m,n;
     double temp;
     AllTFBindingSites *BS_info;
     float *protein_number;
@@ -623,119 +987,147 @@ static void calc_TF_dist_from_all_BS(Genotype *genotype, CellState *state, int g
     BS_info=genotype->all_binding_sites[gene_id];
     
     /* initializing matrices to all zeros */
-    for(i=0;i<max_N_binding_rep;i++) 
-    {
-        for(j=0;j<max_N_binding_act;j++)
-            ratio_matrices[0][i][j]=0.0;
-    }
+    matrix_n=&(ratio_matrices[0]);
+    for(k=0;k<size_of_matrix;k++)
+        matrix_n[k]=0.0;
     
     /* body of the forward algorithm*/    
-    pos_next_record=0; //where in the ratio_matrices to put the next record
-    ratio_matrices[pos_next_record][0][0]=BS_info[0].Kd;   
+    matrix_n[0]=BS_info[0].Kd;   
     /*calculate distribution based on the first BS*/
     if(genotype->protein_identity[BS_info[0].tf_id]==1) // if a activator binds to BS 0   
-        ratio_matrices[pos_next_record][0][1]=protein_number[BS_info[0].tf_id];
+        matrix_n[1]=protein_number[BS_info[0].tf_id];
     else    
-        ratio_matrices[pos_next_record][1][0]=protein_number[BS_info[0].tf_id]; 
+        matrix_n[max_N_binding_act]=protein_number[BS_info[0].tf_id]; 
     /*keep calculating distribution from the remaining BS*/
     for(m=1;m<genotype->binding_sites_num[gene_id];m++)
     {
-        pos_next_record++;
+        matrix_n_minus_1=matrix_n;
+        matrix_n+=size_of_matrix;
         /*If binding of site m blocks other binding sites*/
         product_of_freq = protein_number[BS_info[m].tf_id]; 
-        if(BS_info[m].N_hindered!=0) 
+        for(n=m-BS_info[m].N_hindered;n<=m-1;n++)
+            product_of_freq*=BS_info[n].Kd;            
+        cache_Kd=BS_info[m].Kd;
+        if(m-BS_info[m].N_hindered!=0)//if binding of m does not block all of the BS evaluated before
         {
-            for(n=m-BS_info[m].N_hindered;n<=m-1;n++)
-                product_of_freq*=BS_info[n].Kd;            
+            /*find matrix(n-H)*/
+            matrix_nH=matrix_n_minus_1-BS_info[m].N_hindered*size_of_matrix;
+            /*Check whether m is a site of activator or repressor*/
+            switch(genotype->protein_identity[BS_info[m].tf_id])
+            {
+                case ACTIVATOR: // a BS of activators 
+                    for(k=1;k<size_of_matrix;k++)
+                        matrix_n[k]=cache_Kd*matrix_n_minus_1[k]+product_of_freq*matrix_nH[k-1];
+                    /*configurations without activators cannot come from matrix(n-H); this overwrites what the loop put there*/
+                    for(k=0;k<size_of_matrix;k+=max_N_binding_act)
+                        matrix_n[k]=cache_Kd*matrix_n_minus_1[k];
+                    break;
+                    
+                case REPRESSOR: // a BS of repressors 
+                    for(k=0;k<max_N_binding_act;k++)
+                        matrix_n[k]=cache_Kd*matrix_n_minus_1[k];
+                    for(k=max_N_binding_act;k<size_of_matrix;k++)
+                        matrix_n[k]=cache_Kd*matrix_n_minus_1[k]+product_of_freq*matrix_nH[k-max_N_binding_act];
+                    break;
+            }
         }
-        cache_Kd=BS_info[m].Kd;
-        /*Check whether m is a site of activator or repressor*/
-        switch(genotype->protein_identity[BS_info[m].tf_id])
+        else
         {
-            case ACTIVATOR: // a BS of activators              
-               if(m-BS_info[m].N_hindered!=0)//if binding of m does not block all of the BS evaluated before
-                {      
-                    /*find matrix(n-H)*/
-                    pos_of_mat_nH=pos_next_record-BS_info[m].N_hindered-1; 
-                   /*find matrix(n)*/
-                    pos_of_last_record=pos_next_record-1;
-                    for(i=0;i<max_N_binding_rep;i++)
-                        for(j=1;j<max_N_binding_act;j++) 
-                            ratio_matrices[pos_next_record][i][j]=cache_Kd*ratio_matrices[pos_of_last_record][i][j]+product_of_freq*ratio_matrices[pos_of_mat_nH][i][j-1];
-                   
-                    for(i=0;i<max_N_binding_rep;i++)
-                        ratio_matrices[pos_next_record][i][0]=cache_Kd*ratio_matrices[pos_of_last_record][i][0];                    
-                }
-                else
-                {
-                    /*find matrix(n)*/
-                    pos_of_last_record=pos_next_record-1;  //find last record     
-                    for(i=0;i<max_N_binding_rep;i++)                  
-                        for(j=0;j<max_N_binding_act;j++) 
-                            ratio_matrices[pos_next_record][i][j]=cache_Kd*ratio_matrices[pos_of_last_record][i][j];
-               
-                    ratio_matrices[pos_next_record][0][1]+=product_of_freq;                    
-                }
-                break;
-
-            case REPRESSOR: // a BS of repressors            
-                if(m-BS_info[m].N_hindered!=0)
-                {
-                    /*find matrix(n-H)*/
-                    pos_of_mat_nH=pos_next_record-BS_info[m].N_hindered-1; 
-                    /*find matrix(n)*/
-                    pos_of_last_record=pos_next_record-1; 
-                    /*Similar problem when pos_of_mat_nH=pos_next_record*/
-                    for(i=1;i<max_N_binding_rep;i++)                  
-                        for(j=0;j<max_N_binding_act;j++)
-                            ratio_matrices[pos_next_record][i][j]=cache_Kd*ratio_matrices[pos_of_last_record][i][j]+product_of_freq*ratio_matrices[pos_of_mat_nH][i-1][j];
-                   
-                    for(j=0;j<max_N_binding_act;j++)
-                        ratio_matrices[pos_next_record][0][j]=cache_Kd*ratio_matrices[pos_of_last_record][0][j];     
-                }
-                else
-                {
-                    /*find matrix(n)*/
-                    pos_of_last_record=pos_next_record-1;  
-                    for(i=0;i<max_N_binding_rep;i++)                  
-                        for(j=0;j<max_N_binding_act;j++)
-                            ratio_matrices[pos_next_record][i][j]=cache_Kd*ratio_matrices[pos_of_last_record][i][j];                                                   
-                   
-                    ratio_matrices[pos_next_record][1][0]+=product_of_freq;
-                } 
-                break;
+            for(k=0;k<size_of_matrix;k++)
+                matrix_n[k]=cache_Kd*matrix_n_minus_1[k];
+            if(genotype->protein_identity[BS_info[m].tf_id]==ACTIVATOR)
+                matrix_n[1]+=product_of_freq;
+            else
+                matrix_n[max_N_binding_act]+=product_of_freq;
         }
     }
 
     sum=0.0;
-    for(i=0;i<max_N_binding_rep;i++)    
-        for(j=0;j<max_N_binding_act;j++)     
-            sum+=ratio_matrices[pos_next_record][i][j];
+    for(k=0;k<size_of_matrix;k++)
+        sum+=matrix_n[k];
     
     temp=0.0;
     for(i=0;i<max_N_binding_rep;i++)  
         for(j=genotype->min_N_activator_to_transc[gene_id];j<max_N_binding_act;j++)   
-            temp+=ratio_matrices[pos_next_record][i][j];
+            temp+=matrix_n[i*max_N_binding_act+j];
     state->P_A[gene_id]=(float)(temp/sum);
     
     temp=0.0;
-    for(i=1;i<max_N_binding_rep;i++)  
-        for(j=0;j<max_N_binding_act;j++)
-            temp+=ratio_matrices[pos_next_record][i][j];  
+    for(k=max_N_binding_act;k<size_of_matrix;k++)
+        temp+=matrix_n[k];  
     state->P_R[gene_id]=(float)(temp/sum);
    
 	temp=0.0;
 	for(j=genotype->min_N_activator_to_transc[gene_id];j<max_N_binding_act;j++)
-		temp+=ratio_matrices[pos_next_record][0][j];
+		temp+=matrix_n[j];
 	state->P_A_no_R[gene_id]=(float)(temp / sum);
     
     temp=0.0;
     for(j=0;j<genotype->min_N_activator_to_transc[gene_id];j++)
-        temp+=ratio_matrices[pos_next_record][0][j];
+        temp+=matrix_n[j];
     state->P_NotA_no_R[gene_id]=(float)(temp/sum);    
 }
 
 
+/*
+ * compute the cost of translation of every gene and their total. It is called when the cell is
+ * initialized; afterwards only the cost of the gene whose mRNAs change is recomputed by update_cost_of_expression.
+ */
+static void calc_cost_of_expression(Genotype *genotype, CellState *state)
+{
+    int i;
+    for(i=N_SIGNAL_TF; i < genotype->ngenes; i++)        
+        state->cost_of_translation[i]=(genotype->translation_rate[i]*(float)state->mRNA_aft_transl_delay_num[i]+
+                                    0.5*genotype->translation_rate[i]*(float)state->mRNA_under_transl_delay_num[i])*(float)genotype->locus_length[i]/236.0; //236 codon is the average length of yeast protein
+    sum_cost_of_expression(genotype, state);
+}
+
+/*
+ * recompute the cost of translation of gene_id after its mRNA counts change, and the total cost.
+ */
+static void update_cost_of_expression(Genotype *genotype, CellState *state, int gene_id)
+{
+    state->cost_of_translation[gene_id]=(genotype->translation_rate[gene_id]*(float)state->mRNA_aft_transl_delay_num[gene_id]+
+                                    0.5*genotype->translation_rate[gene_id]*(float)state->mRNA_under_transl_delay_num[gene_id])*(float)genotype->locus_length[gene_id]/236.0;
+    sum_cost_of_expression(genotype, state);
+}
+
+/*
+ * add up the cost of translation of the genes in the same order and precision as the sum 
+ * that used to be done on every event, so that fitness is unchanged to the last bit. 
+ */
+static void sum_cost_of_expression(Genotype *genotype, CellState *state)
+{
+    int i;
+    float total_translation_rate = 0.0;
+    for(i=N_SIGNAL_TF; i < genotype->ngenes; i++)
+        total_translation_rate += state->cost_of_translation[i];
+    state->cost_of_expression=total_translation_rate*c_transl;
+}
+
+#if FAST_EXP
+/*
+ * exp(x) for x in float range, without branches so that the loop over genes can be 
+ * vectorized. x=n*ln2+r with |r|<=ln2/2, and exp(r) is a degree-6 Taylor polynomial.
+ * Relative error is below 3e-7.
+ */
+static inline float fast_exp(float x)
+{
+    float t, r, p;
+    int n;
+    union {float f; int i;} scale;
+    x=(x<-87.0f)?-87.0f:x;
+    x=(x>88.0f)?88.0f:x;
+    t=x*1.44269504f;
+    n=(int)((t<0.0f)?t-0.5f:t+0.5f);
+    r=x-(float)n*0.693145752f; /* ln2 split into a part exact in float and the rest */
+    r=r-(float)n*1.42860677e-6f;
+    p=1.0f+r*(1.0f+r*(0.5f+r*(1.66666667e-1f+r*(4.16666667e-2f+r*(8.33333333e-3f+r*1.38888889e-3f)))));
+    scale.i=(n+127)<<23;
+    return p*scale.f;
+}
+#endif
+
 /* 
  * update both the protein concentration and current cell size *
  * 
@@ -748,6 +1140,10 @@ static void update_protein_number_and_fitness( Genotype *genotype,
     int i,j;
     float ct, ect, one_minus_ect;
     float N_effector_molecules_bf_dt[genotype->protein_pool[genotype->nproteins-1][0][0]];
+#if CLOSED_FORM_TPRIME
+    float one_minus_ect_of_gene[MAX_GENES];
+    float one_minus_ect_of_effector[genotype->protein_pool[genotype->nproteins-1][0][0]];
+#endif
     float instantaneous_fitness = 0.0;
     float integrated_fitness = 0.0;
   
@@ -758,9 +1154,15 @@ static void update_protein_number_and_fitness( Genotype *genotype,
     for (i=N_SIGNAL_TF; i < genotype->ngenes; i++) 
     {     
         ct=genotype->protein_decay_rate[i]*dt;
+#if FAST_EXP
+        ect = fast_exp(-ct);
+#else
         ect = exp(-ct);
-        if (fabs(ct)<EPSILON) one_minus_ect=ct;
-        else one_minus_ect = 1.0-ect;      
+#endif
+        one_minus_ect = (fabs(ct)<EPSILON)?ct:1.0-ect;      
+#if CLOSED_FORM_TPRIME
+        one_minus_ect_of_gene[i]=one_minus_ect;
+#endif
         /* get the new protein concentration for this gene */
         state->gene_specific_protein_number[i]=ect*state->gene_specific_protein_number[i]+state->protein_synthesis_index[i]*one_minus_ect;        
     }    
@@ -772,11 +1174,24 @@ static void update_protein_number_and_fitness( Genotype *genotype,
             state->protein_number[i]+=state->gene_specific_protein_number[genotype->protein_pool[i][1][j]];
     }   
     /* now find out the protein numbers at end of dt interval and compute instantaneous and cumulative fitness */   
+#if CLOSED_FORM_TPRIME
+    /* the integration of fitness reuses the decay factors of the effector genes*/
+    for(i=0;i<genotype->protein_pool[genotype->nproteins-1][0][0];i++)
+        one_minus_ect_of_effector[i]=one_minus_ect_of_gene[genotype->protein_pool[genotype->nproteins-1][1][i]];
     instantaneous_fitness = calc_fitness(&integrated_fitness, 
                                             genotype, 
                                             state, 
                                             N_effector_molecules_bf_dt, 
+                                            one_minus_ect_of_effector,
                                             dt);  
+#else
+    instantaneous_fitness = calc_fitness(&integrated_fitness, 
+                                            genotype, 
+                                            state, 
+                                            N_effector_molecules_bf_dt, 
+                                            NULL,
+                                            dt);  
+#endif
     /* update cumulative fitness at the end of dt*/
     state->cumulative_fitness += integrated_fitness;    
     /* update the instantaneous fitness at the end of dt */
@@ -817,6 +1232,7 @@ static int Gillespie_event_mRNA_decay(GillespieRates *rates, CellState *state, G
         (state->mRNA_aft_transl_delay_num[gene_id])--;  
         /*update protein synthesis rate*/
         state->protein_synthesis_index[gene_id] = (float)state->mRNA_aft_transl_delay_num[gene_id]*genotype->translation_rate[gene_id]/genotype->protein_decay_rate[gene_id];
+        update_cost_of_expression(genotype, state, gene_id);
         if(genotype->which_protein[gene_id]==genotype->nproteins-1)
         	return DO_NOTHING;
     	else // an mRNA of transcription factor is degraded, which can cause fluctuation in transcription factor concentrations.
@@ -830,6 +1246,7 @@ static int Gillespie_event_mRNA_decay(GillespieRates *rates, CellState *state, G
         delete_fixed_event(gene_id, mRNA_id, &(state->mRNA_transl_init_time_end_head), &(state->mRNA_transl_init_time_end_tail));       
         /* remove the mRNA from the count */
         (state->mRNA_under_transl_delay_num[gene_id])--; 
+        update_cost_of_expression(genotype, state, gene_id);
         return DO_NOTHING;
     }
 }
@@ -851,7 +1268,8 @@ static void Gillespie_event_repressed_to_intermediate(GillespieRates *rates, Cel
             break;
     }
     /* set state */
-    state->transcriptional_state[gene_id]=INTERMEDIATE;
+    state->N_promoters_in_state[gene_id][REPRESSED]--;
+    state->N_promoters_in_state[gene_id][INTERMEDIATE]++;
 }
 
 static void Gillespie_event_intermediate_to_repressed(GillespieRates *rates, CellState *state, Genotype *genotype, RngStream RS)
@@ -872,7 +1290,8 @@ static void Gillespie_event_intermediate_to_repressed(GillespieRates *rates, Cel
             break;
     }
     /* set state */
-    state->transcriptional_state[gene_id]=REPRESSED;
+    state->N_promoters_in_state[gene_id][INTERMEDIATE]--;
+    state->N_promoters_in_state[gene_id][REPRESSED]++;
 }
 
 static void Gillespie_event_intermediate_to_active(GillespieRates *rates, CellState *state, Genotype *genotype, RngStream RS)
@@ -893,7 +1312,8 @@ static void Gillespie_event_intermediate_to_active(GillespieRates *rates, CellSt
             break;
     }
     /* set state */
-    state->transcriptional_state[gene_id] =ACTIVE;  
+    state->N_promoters_in_state[gene_id][INTERMEDIATE]--;
+    state->N_promoters_in_state[gene_id][ACTIVE]++;
 }
 
 static void Gillespie_event_active_to_intermediate(Genotype *genotype, CellState *state,GillespieRates *rates, RngStream RS)
@@ -912,7 +1332,8 @@ static void Gillespie_event_active_to_intermediate(Genotype *genotype, CellState
         if(rates->active_to_intermediate_rate[gene_id]>0.0)
             break;
     }
-    state->transcriptional_state[gene_id]=INTERMEDIATE;   
+    state->N_promoters_in_state[gene_id][ACTIVE]--;
+    state->N_promoters_in_state[gene_id][INTERMEDIATE]++;
 }
 
 static void Gillespie_event_transcription_init(GillespieRates *rates, CellState *state, Genotype *genotype, float dt, RngStream RS)
@@ -968,9 +1389,10 @@ static int do_fixed_event(Genotype *genotype,
             state->cell_activated=1;
             break;
         case 3:     /* turn signal off*/ 
-            *dt = state->signal_off_head->time - state->t;     
+            *dt = state->t_next_signal_off - state->t;     
             update_protein_number_and_fitness(genotype, state, rates, *dt); 
-            delete_fixed_event_from_head(&(state->signal_off_head),&(state->signal_off_tail));
+            state->next_signal_off++;
+            update_next_signal_events(state);
             if(env->fixed_effector_effect)
                 state->effect_of_effector=env->effect_of_effector_aft_burn_in;
             else
@@ -979,9 +1401,10 @@ static int do_fixed_event(Genotype *genotype,
             return_value=SUDDEN_SIGNAL_CHANGE;
             break;
         case 4:     /*turn signal on*/
-            *dt = state->signal_on_head->time - state->t;   
+            *dt = state->t_next_signal_on - state->t;   
             update_protein_number_and_fitness(genotype, state, rates, *dt);  
-            delete_fixed_event_from_head(&(state->signal_on_head),&(state->signal_on_tail));
+            state->next_signal_on++;
+            update_next_signal_events(state);
             state->protein_number[N_SIGNAL_TF-1]=env->signal_on_strength;
             if(env->fixed_effector_effect)                               
                 state->effect_of_effector=env->effect_of_effector_aft_burn_in;            
@@ -1006,10 +1429,11 @@ static int do_fixed_event(Genotype *genotype,
             update_protein_number_and_fitness(genotype, state, rates, *dt);          
             break;
         case 7: /* update signal strength */
-            *dt=state->change_signal_strength_head->time-state->t;
+            *dt=state->t_next_signal_change-state->t;
             update_protein_number_and_fitness(genotype, state, rates, *dt);
-            state->protein_number[N_SIGNAL_TF-1]=env->external_signal[state->change_signal_strength_head->event_id];
-            delete_fixed_event_from_head(&(state->change_signal_strength_head),&(state->change_signal_strength_tail));
+            state->protein_number[N_SIGNAL_TF-1]=env->external_signal[state->next_signal_change+1];
+            state->next_signal_change++;
+            update_next_signal_events(state);
             return_value=SUDDEN_SIGNAL_CHANGE;
             break;     
         case 8: /* record expression levels*/
@@ -1096,6 +1520,55 @@ static int do_Gillespie_event(Genotype *genotype,
     return return_value;
 }
 
+/*
+ * signal strength and the effect of the effector at time t of the mean-field model.
+ * The signal changes at the same time as in the schedule built by build_signal_schedule.
+ */
+static void set_mean_field_signal(Environment *env, float t_burn_in, float t, float *signal, char *effect_of_effector)
+{
+    float t_change;
+    char flag;
+    if(t<t_burn_in)
+    {
+        *signal=0.0;
+        *effect_of_effector=env->initial_effect_of_effector;
+        return;
+    }
+    *signal=(env->signal_on_aft_burn_in==1)?env->signal_on_strength:env->signal_off_strength;
+    *effect_of_effector=env->effect_of_effector_aft_burn_in;
+    t_change=t_burn_in;
+    flag='o';
+    while(t_change<env->t_development+t_burn_in)
+    {
+        if(flag=='o')
+        {
+            if(env->t_signal_on!=0.0)
+            {
+                t_change+=env->t_signal_on;
+                if(t_change>t)
+                    return;
+                *signal=env->signal_off_strength;
+                if(!env->fixed_effector_effect)
+                    *effect_of_effector='d';
+            }
+            flag='f';
+        }
+        else
+        {
+            if(env->t_signal_off!=0.0)
+            {
+                t_change+=env->t_signal_off;
+                if(t_change>t)
+                    return;
+                *signal=env->signal_on_strength;
+                if(!env->fixed_effector_effect)
+                    *effect_of_effector='b';
+            }
+            flag='o';
+        }
+    }
+}
+
 /* 
  * check to see if a fixed event ends within dt
  *
@@ -1124,11 +1597,11 @@ static int does_fixed_event_end(CellState *state, float t)
     float t8;
     t1 = state->mRNA_transcr_time_end_head ? state->mRNA_transcr_time_end_head->time : TIME_INFINITY;
     t2 = state->mRNA_transl_init_time_end_head ? state->mRNA_transl_init_time_end_head->time : TIME_INFINITY;
-    t3 = state->signal_off_head? state->signal_off_head->time : TIME_INFINITY;
-    t4 = state->signal_on_head ? state->signal_on_head->time : TIME_INFINITY;
+    t3 = state->t_next_signal_off;
+    t4 = state->t_next_signal_on;
     t5 = state->burn_in_growth_rate_head ? state->burn_in_growth_rate_head->time : TIME_INFINITY;
     t6 = state->t_to_update_probability_of_binding;
-    t7 = state->change_signal_strength_head ? state->change_signal_strength_head->time : TIME_INFINITY;
+    t7 = state->t_next_signal_change;
     t8 = state->sampling_point_end_head?state->sampling_point_end_head->time : TIME_INFINITY;
     if((t1 <= t2) && (t1 <= t) && (t1 <= t3) && (t1 <= t4) && (t1<=t5) &&(t1<=t6) && (t1<=t7) && (t1<=t8))
     {
@@ -1191,6 +1664,7 @@ static void fixed_event_end_transcription( float *dt,
     (state->mRNA_under_transl_delay_num[gene_id])++;
     /* decrease the number of mRNAs undergoing transcription */
     (state->mRNA_under_transc_num[gene_id])--;
+    update_cost_of_expression(genotype, state, gene_id);
     /* delete the fixed even which has just occurred */
     if(state->mRNA_transcr_time_end_head==NULL)
     {
@@ -1243,6 +1717,7 @@ static int fixed_event_end_translation_init(   Genotype *genotype,
     (state->mRNA_aft_transl_delay_num[gene_id])++;   
     /* update protein synthesis rate*/
     state->protein_synthesis_index[gene_id]= (float)state->mRNA_aft_transl_delay_num[gene_id]*genotype->translation_rate[gene_id]/genotype->protein_decay_rate[gene_id];
+    update_cost_of_expression(genotype, state, gene_id);
     
     if(genotype->which_protein[gene_id]==genotype->nproteins-1)//if the mRNA encodes a non-sensor TF, there could be a huge change in TF concentration
         return DO_NOTHING;
@@ -1284,6 +1759,13 @@ static void calc_leaping_interval(Genotype *genotype, CellState *state, float *m
         {
             /* check if much change is possible within the duration of simulation*/
             N_proteins_cause_change=Kd*(P_binding+MAX_TOLERABLE_CHANGE_IN_PROBABILITY_OF_BINDING)/(1.0-P_binding-MAX_TOLERABLE_CHANGE_IN_PROBABILITY_OF_BINDING); 
+#if CLOSED_FORM_TPRIME
+            if(genotype->protein_pool[protein_id][0][0]==1)
+            {
+                *minimal_interval=fminf(*minimal_interval,calc_leaping_interval_single_copy(genotype,state,protein_id,N_proteins_cause_change,t_remaining,t_unreachable));
+                return;
+            }
+#endif
             /* calc N_protein at the end of simulation*/
             N_at_end_of_simulation=0.0;
             for(j=0;j<genotype->protein_pool[protein_id][0][0];j++) 
@@ -1317,6 +1799,13 @@ static void calc_leaping_interval(Genotype *genotype, CellState *state, float *m
         {
             /* first check if much change is possible within the duration of simulation*/
             N_proteins_cause_change=Kd*(P_binding-MAX_TOLERABLE_CHANGE_IN_PROBABILITY_OF_BINDING)/(1.0-P_binding+MAX_TOLERABLE_CHANGE_IN_PROBABILITY_OF_BINDING); 
+#if CLOSED_FORM_TPRIME
+            if(genotype->protein_pool[protein_id][0][0]==1)
+            {
+                *minimal_interval=fminf(*minimal_interval,calc_leaping_interval_single_copy(genotype,state,protein_id,N_proteins_cause_change,t_remaining,t_unreachable));
+                return;
+            }
+#endif
             /* calc N_protein at the end of simulation*/
             N_at_end_of_simulation=0.0;
             for(j=0;j<genotype->protein_pool[protein_id][0][0];j++) 
@@ -1344,5 +1833,29 @@ static void calc_leaping_interval(Genotype *genotype, CellState *state, float *m
     }
 }
 
+#if CLOSED_FORM_TPRIME
+/*
+ * calc_leaping_interval for a protein encoded by a single gene. The time at which the protein 
+ * reaches N_proteins_cause_change is solved in closed form.
+ */
+static float calc_leaping_interval_single_copy(Genotype *genotype, CellState *state, int protein_id, float N_proteins_cause_change, float t_remaining, float t_unreachable)
+{
+    int gene_id;
+    float ratio,dt;
+    
+    gene_id=genotype->protein_pool[protein_id][1][0];
+    /* N(t)-Ns=(N(0)-Ns)exp(-kt), where Ns is protein_synthesis_index. 
+     * N_proteins_cause_change is reachable only if it lies between N(0) and Ns*/
+    ratio=(N_proteins_cause_change-state->protein_synthesis_index[gene_id])/(state->gene_specific_protein_number[gene_id]-state->protein_synthesis_index[gene_id]);
+    if(ratio>0.0 && ratio<1.0)
+    {
+        dt=-log(ratio)/genotype->protein_decay_rate[gene_id];
+        if(dt<=t_remaining)
+            return dt;
+    }
+    return t_unreachable;
+}
+#endif
+
 
 
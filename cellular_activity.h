@@ -78,16 +78,18 @@ struct CellState {
     FixedEvent *mRNA_transl_init_time_end_tail;  
     FixedEvent *mRNA_transcr_time_end_head;  /* times when transcription is complete and an mRNA is available to move to cytoplasm */
     FixedEvent *mRNA_transcr_time_end_tail;
-    FixedEvent *signal_off_head;          /* times when env=A ends. Note, this event is not gene- or copy-specific. I just use the structure of FixedEvent for convenience.*/
-    FixedEvent *signal_off_tail;   
-    FixedEvent *signal_on_head;          /* times when env=A ends. Note, this event is not gene- or copy-specific. I just use the structure of FixedEvent for convenience.*/
-    FixedEvent *signal_on_tail; 
     FixedEvent *burn_in_growth_rate_head;
     FixedEvent *burn_in_growth_rate_tail;  
     FixedEvent *sampling_point_end_head;
     FixedEvent *sampling_point_end_tail;
-    FixedEvent *change_signal_strength_head;
-    FixedEvent *change_signal_strength_tail;
+    SignalSchedule *signal_schedule;      /* when the signal changes. Shared by all replicates of an environment */
+    float t_burn_in;                      /* times to turn the signal on or off are relative to this */
+    int next_signal_off;                  /* indices of the next events in signal_schedule */
+    int next_signal_on;
+    int next_signal_change;
+    float t_next_signal_off;              /* times of the next events, TIME_INFINITY if none are left */
+    float t_next_signal_on;
+    float t_next_signal_change;
 
     char effect_of_effector;
     int cell_activated;
@@ -107,7 +109,10 @@ struct CellState {
                                                * can be considered temporary data. Make muation easier to
                                                * deal with. */  
     float protein_synthesis_index[MAX_GENES];  /*this is N_mRNA*translation_rate/degradation rate.*/
-    int transcriptional_state[MAX_GENES];       /*can be REPRESSED, INTERMEDIATE, or ACTIVE */
+    double cost_of_translation[MAX_GENES];     /* cost of translation of each gene, before scaling by c_transl */
+    float cost_of_expression;                  /* cost of translation, updated when the number of mRNAs changes */
+    int N_promoters_in_state[MAX_GENES][3];     /* number of copies of a gene whose promoter is REPRESSED, INTERMEDIATE, or ACTIVE.
+                                                * A gene has more than one copy only if identical copies are lumped */
 };
 
 void initialize_cell(Genotype *, CellState *, Environment *, float, int [MAX_GENES], float [MAX_PROTEINS]);
@@ -116,5 +121,7 @@ void do_single_timestep(Genotype *, CellState *, GillespieRates *, Environment *
 
 void calc_all_rates(Genotype *, CellState *, GillespieRates *, Environment *, Phenotype *, float, int);
 
+float calc_mean_field_fitness(Genotype *, Environment *, float, int [MAX_GENES], float [MAX_GENES]);
+
 #endif /* EXPRESSION_DYNAMICS_H */
 
@@ -0,0 +1,292 @@
+/*
+ * This file converts residents.bin and mutants.bin, which are written
+ * when BINARY_OUTPUT is 1, into the text files written otherwise.
+ *
+ * Usage:
+ *   convert_output residents.bin evo_summary_481.txt accepted_mutation_481.txt precise_fitness.txt N_motifs.txt [N_near_AND_gated_motifs.txt]
+ *   convert_output mutants.bin all_mutations.txt fitness_all_mutants.txt
+ * Text is appended to the files, so converting residents.bin into the evo_summary
+ * and N_motifs.txt of the same simulation completes them after the lines of step 0.
+
+ * Authors: Joanna Masel, Alex Lancaster, Kun Xiong
+ * Copyright (c) 2018 Arizona Board of Regents on behalf of the University of Arizona
+
+ * This file is part of network-evolution-simulator.
+ * network-evolution-simulator is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * network-evolution-simulator is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with network-evolution-simulator. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "netsim.h"
+
+static int N_columns;
+static OutputColumn *columns;
+
+static void quit(char *message, char *file_name)
+{
+    printf("%s %s! Quit program!\n",message,file_name);
+    exit(-2);
+}
+
+/*index of a column, or -1 if the file does not have it*/
+static int find_column(char *name)
+{
+    int i;
+    for(i=0;i<N_columns;i++)
+    {
+        if(strcmp(columns[i].name,name)==0)
+            return i;
+    }
+    return -1;
+}
+
+/*the index of a column that every file of the kind must have*/
+static int require_column(char *name)
+{
+    int i=find_column(name);
+    if(i==-1)
+        quit("Missing column",name);
+    return i;
+}
+
+static int get_int(char *record, int column, int element)
+{
+    int int32;
+    short int16;
+    if(columns[column].type=='s')
+    {
+        memcpy(&int16,record+columns[column].offset+2*element,2);
+        return (int)int16;
+    }
+    memcpy(&int32,record+columns[column].offset+4*element,4);
+    return int32;
+}
+
+static float get_float(char *record, int column)
+{
+    float f;
+    memcpy(&f,record+columns[column].offset,4);
+    return f;
+}
+
+static char get_char(char *record, int column, int element)
+{
+    return record[columns[column].offset+element];
+}
+
+static FILE *open_text_file(char *file_name)
+{
+    FILE *fp=fopen(file_name,"a");
+    if(fp==NULL)
+        quit("Cannot write",file_name);
+    return fp;
+}
+
+static void convert_residents(FILE *fp_bin, char *record, int record_size, char *file_names[], int N_file_names)
+{
+    int i;
+    int step,n_tot_mut,n_mut_at_the_step,n_hit_bound,mut_type,which_gene,which_nuc,new_nuc,which_kinetic,new_kinetic;
+    int selection_coefficient,avg_f,f1,f2,se_avg_f,se_f1,se_f2,variance_reduction,n_replicates;
+    int n_gene,n_effector_genes,n_act,n_rep,n_motifs,n_near_AND_gated_motifs;
+    FILE *fp_summary,*fp_mutation,*fp_fitness,*fp_motifs,*fp_near_AND=NULL;
+
+    step=require_column("step");
+    n_tot_mut=require_column("n_tot_mut");
+    n_mut_at_the_step=require_column("n_mut_at_the_step");
+    n_hit_bound=require_column("n_hit_bound");
+    mut_type=require_column("mut_type");
+    which_gene=require_column("which_gene");
+    which_nuc=require_column("which_nuc");
+    new_nuc=require_column("new_nuc");
+    which_kinetic=require_column("which_kinetic");
+    new_kinetic=require_column("new_kinetic");
+    selection_coefficient=require_column("selection_coefficient");
+    avg_f=require_column("avg_f");
+    f1=require_column("f1");
+    f2=require_column("f2");
+    se_avg_f=require_column("se_avg_f");
+    se_f1=require_column("se_f1");
+    se_f2=require_column("se_f2");
+    variance_reduction=find_column("variance_reduction");
+    n_replicates=find_column("n_replicates");
+    n_gene=require_column("n_gene");
+    n_effector_genes=require_column("n_effector_genes");
+    n_act=require_column("n_act");
+    n_rep=require_column("n_rep");
+    n_motifs=require_column("n_motifs");
+    n_near_AND_gated_motifs=find_column("n_near_AND_gated_motifs");
+
+    fp_summary=open_text_file(file_names[0]);
+    fp_mutation=open_text_file(file_names[1]);
+    fp_fitness=open_text_file(file_names[2]);
+    fp_motifs=open_text_file(file_names[3]);
+    if(n_near_AND_gated_motifs!=-1 && N_file_names>4)
+        fp_near_AND=open_text_file(file_names[4]);
+
+    while(fread(record,record_size,1,fp_bin)==1)
+    {
+        for(i=0;i<columns[n_motifs].count;i++)
+            fprintf(fp_motifs,"%d ",get_int(record,n_motifs,i));
+        fprintf(fp_motifs,"\n");
+        if(fp_near_AND!=NULL)
+        {
+            for(i=0;i<columns[n_near_AND_gated_motifs].count;i++)
+                fprintf(fp_near_AND,"%d ",get_int(record,n_near_AND_gated_motifs,i));
+            fprintf(fp_near_AND,"\n");
+        }
+        fprintf(fp_mutation,"%c %d %d '%.3s' %d %a\n", get_char(record,mut_type,0),
+                                                      get_int(record,which_gene,0),
+                                                      get_int(record,which_nuc,0),
+                                                      record+columns[new_nuc].offset,
+                                                      get_int(record,which_kinetic,0),
+                                                      get_float(record,new_kinetic));
+        fprintf(fp_fitness,"%d %d %a %a %a %a %a %a",get_int(record,n_tot_mut,0),
+                                                    get_int(record,n_hit_bound,0),
+                                                    get_float(record,avg_f),
+                                                    get_float(record,f1),
+                                                    get_float(record,f2),
+                                                    get_float(record,se_avg_f),
+                                                    get_float(record,se_f1),
+                                                    get_float(record,se_f2));
+        if(variance_reduction!=-1)
+            fprintf(fp_fitness," %a",get_float(record,variance_reduction));
+        if(n_replicates!=-1)
+            fprintf(fp_fitness," %d",get_int(record,n_replicates,0));
+        fprintf(fp_fitness,"\n");
+        fprintf(fp_summary,"%d %d %d %d %c %f %.10f %.10f %.10f %.10f %.10f %.10f %d %d %d %d\n",
+                get_int(record,step,0),
+                get_int(record,n_tot_mut,0),
+                get_int(record,n_mut_at_the_step,0),
+                get_int(record,n_hit_bound,0),
+                get_char(record,mut_type,0),
+                get_float(record,selection_coefficient),
+                get_float(record,avg_f),
+                get_float(record,f1),
+                get_float(record,f2),
+                get_float(record,se_avg_f),
+                get_float(record,se_f1),
+                get_float(record,se_f2),
+                get_int(record,n_gene,0),
+                get_int(record,n_effector_genes,0),
+                get_int(record,n_act,0),
+                get_int(record,n_rep,0));
+    }
+    fclose(fp_summary);
+    fclose(fp_mutation);
+    fclose(fp_fitness);
+    fclose(fp_motifs);
+    if(fp_near_AND!=NULL)
+        fclose(fp_near_AND);
+}
+
+static void convert_mutants(FILE *fp_bin, char *record, int record_size, char *file_names[])
+{
+    int step,n_tot_mut,mut_type,which_gene,which_nuc,new_nuc,which_kinetic,new_kinetic;
+    int avg_f,f1,f2,se_avg_f,se_f1,se_f2,avg_f_diff,se_avg_f_diff,variance_reduction;
+    int mean_field_f,mean_field_resident_f,screened_out;
+    FILE *fp_mutation,*fp_fitness;
+
+    step=require_column("step");
+    n_tot_mut=require_column("n_tot_mut");
+    mut_type=require_column("mut_type");
+    which_gene=require_column("which_gene");
+    which_nuc=require_column("which_nuc");
+    new_nuc=require_column("new_nuc");
+    which_kinetic=require_column("which_kinetic");
+    new_kinetic=require_column("new_kinetic");
+    avg_f=require_column("avg_f");
+    f1=require_column("f1");
+    f2=require_column("f2");
+    se_avg_f=require_column("se_avg_f");
+    se_f1=require_column("se_f1");
+    se_f2=require_column("se_f2");
+    avg_f_diff=find_column("avg_f_diff");
+    se_avg_f_diff=find_column("se_avg_f_diff");
+    variance_reduction=find_column("variance_reduction");
+    mean_field_f=find_column("mean_field_f");
+    mean_field_resident_f=find_column("mean_field_resident_f");
+    screened_out=find_column("screened_out");
+
+    fp_mutation=open_text_file(file_names[0]);
+    fp_fitness=open_text_file(file_names[1]);
+    while(fread(record,record_size,1,fp_bin)==1)
+    {
+        fprintf(fp_mutation,"%d %d %c %d %d '%.3s' %d %a\n",
+                get_int(record,step,0),
+                get_int(record,n_tot_mut,0),
+                get_char(record,mut_type,0),
+                get_int(record,which_gene,0),
+                get_int(record,which_nuc,0),
+                record+columns[new_nuc].offset,
+                get_int(record,which_kinetic,0),
+                get_float(record,new_kinetic));
+        fprintf(fp_fitness,"%.10f %.10f %.10f %.10f %.10f %.10f",
+                get_float(record,avg_f),
+                get_float(record,f1),
+                get_float(record,f2),
+                get_float(record,se_avg_f),
+                get_float(record,se_f1),
+                get_float(record,se_f2));
+        if(avg_f_diff!=-1 && se_avg_f_diff!=-1)
+            fprintf(fp_fitness," %.10f %.10f",get_float(record,avg_f_diff),get_float(record,se_avg_f_diff));
+        if(variance_reduction!=-1)
+            fprintf(fp_fitness," %.4f",get_float(record,variance_reduction));
+        if(mean_field_f!=-1 && mean_field_resident_f!=-1 && screened_out!=-1)
+            fprintf(fp_fitness," %.10f %.10f %d",
+                    get_float(record,mean_field_f),
+                    get_float(record,mean_field_resident_f),
+                    get_int(record,screened_out,0));
+        fprintf(fp_fitness,"\n");
+    }
+    fclose(fp_mutation);
+    fclose(fp_fitness);
+}
+
+int main(int argc, char *argv[])
+{
+    int record_size;
+    char magic[8];
+    char *record;
+    FILE *fp;
+
+    if(argc<4)
+    {
+        printf("Usage: %s residents.bin evo_summary accepted_mutation precise_fitness N_motifs [N_near_AND_gated_motifs]\n",argv[0]);
+        printf("       %s mutants.bin all_mutations fitness_all_mutants\n",argv[0]);
+        return -1;
+    }
+    fp=fopen(argv[1],"rb");
+    if(fp==NULL)
+        quit("Cannot open",argv[1]);
+    if(fread(magic,1,8,fp)!=8 || memcmp(magic,"NSRECRD1",8)!=0 ||
+        fread(&N_columns,sizeof(int),1,fp)!=1 || fread(&record_size,sizeof(int),1,fp)!=1 ||
+        N_columns<=0 || record_size<=0)
+        quit("Not a file of records:",argv[1]);
+    columns=(OutputColumn *)malloc(N_columns*sizeof(OutputColumn));
+    if(fread(columns,sizeof(OutputColumn),N_columns,fp)!=(size_t)N_columns)
+        quit("Truncated header in",argv[1]);
+    record=(char *)malloc(record_size);
+
+    if(find_column("n_motifs")!=-1)
+    {
+        if(argc<6)
+            quit("Four text files are needed to convert",argv[1]);
+        convert_residents(fp,record,record_size,&(argv[2]),argc-2);
+    }
+    else
+        convert_mutants(fp,record,record_size,&(argv[2]));
+
+    fclose(fp);
+    free(record);
+    free(columns);
+    return 0;
+}
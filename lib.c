@@ -21,11 +21,91 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include "lib.h"
+#if IRREG_SIGNAL
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/*
+ * FixedEvents are cut from slabs owned by each thread. Freed events go to a free list, 
+ * and free_fixedevent returns all events of a replicate at once by rewinding the slabs.
+ */
+#define FIXED_EVENT_SLAB_SIZE 256
+
+typedef struct FixedEventSlab FixedEventSlab;
+struct FixedEventSlab
+{
+    FixedEvent events[FIXED_EVENT_SLAB_SIZE];
+    FixedEventSlab *next;
+};
+
+typedef struct FixedEventPool FixedEventPool;
+struct FixedEventPool
+{
+    FixedEventSlab *first_slab;
+    FixedEventSlab *current_slab;       /* new events are cut from this slab */
+    int N_used_in_current_slab;
+    FixedEvent *free_list;              /* events freed since the last rewind */
+    long N_events_allocated;            /* statistics, see release_fixed_event_pool*/
+    long N_slabs_allocated;
+};
+
+static FixedEventPool event_pool; /* zero-initialized */
+#pragma omp threadprivate(event_pool)
+
+static FixedEvent *allocate_fixed_event(void);
+
+static void recycle_fixed_event(FixedEvent *);
 
 static int sls_store(FixedEvent *i, 
 		     FixedEvent **start, 
 		      FixedEvent **last);
 
+static FixedEvent *allocate_fixed_event(void)
+{
+    FixedEvent *new_event;
+    FixedEventSlab *new_slab;
+    
+    event_pool.N_events_allocated++;
+    if(event_pool.free_list!=NULL)
+    {
+        new_event=event_pool.free_list;
+        event_pool.free_list=new_event->next;
+        return new_event;
+    }
+    if(event_pool.current_slab==NULL || event_pool.N_used_in_current_slab==FIXED_EVENT_SLAB_SIZE)
+    {
+        if(event_pool.current_slab!=NULL && event_pool.current_slab->next!=NULL) //reuse a slab of an earlier replicate
+            event_pool.current_slab=event_pool.current_slab->next;
+        else
+        {
+            new_slab=malloc(sizeof(FixedEventSlab));
+            if(!new_slab)
+                return NULL;
+            new_slab->next=NULL;
+            event_pool.N_slabs_allocated++;
+            if(event_pool.current_slab==NULL)
+                event_pool.first_slab=new_slab;
+            else
+                event_pool.current_slab->next=new_slab;
+            event_pool.current_slab=new_slab;
+        }
+        event_pool.N_used_in_current_slab=0;
+    }
+    new_event=&(event_pool.current_slab->events[event_pool.N_used_in_current_slab]);
+    event_pool.N_used_in_current_slab++;
+    return new_event;
+}
+
+static void recycle_fixed_event(FixedEvent *event)
+{
+    event->next=event_pool.free_list;
+    event_pool.free_list=event;
+}
+
 static int sls_store(FixedEvent *i, 
 	      FixedEvent **start, 
 	      FixedEvent **last)
@@ -77,7 +157,7 @@ int add_fixed_event(int i,
     FixedEvent *newtime;
     int pos;    
 
-    newtime = malloc(sizeof*newtime);
+    newtime = allocate_fixed_event();
     if (!newtime) 
     {   
 #if MAKE_LOG
@@ -146,7 +226,7 @@ void delete_fixed_event(int gene_x,
 #endif
         exit(1);
     }
-    free(info);
+    recycle_fixed_event(info);
 }
 
 void delete_fixed_event_from_head(FixedEvent **head,FixedEvent **tail)
@@ -157,81 +237,53 @@ void delete_fixed_event_from_head(FixedEvent **head,FixedEvent **tail)
     *head = info->next;
     if (*tail == info) 
         *tail = NULL;
-    free(info);
+    recycle_fixed_event(info);
 }
 
-/*Free linked tables*/
+/*Free linked tables. All events of the thread are returned to its pool at once*/
 void free_fixedevent(CellState *state)
 {
-    FixedEvent *temp1, *temp2;
-    /*signal_on_starts_end*/
-    temp1=state->signal_on_head;
-    while(temp1){		
-            temp2=temp1;
-            temp1=temp1->next;            
-            free(temp2);	
-    }
-    state->signal_on_head=NULL;
-    state->signal_on_tail=NULL;
-    /*signal_off_starts_end*/
-    temp1=state->signal_off_head;
-    while(temp1){
-            temp2=temp1;
-            temp1=temp1->next;            
-            free(temp2);	
-    }
-    state->signal_off_head=NULL;
-    state->signal_off_tail=NULL;
-    /*mRNA_transcr_time_end*/
-    temp1=state->mRNA_transcr_time_end_head;
-    while(temp1){
-            temp2=temp1;
-            temp1=temp1->next;           
-            free(temp2);	
-    }
     state->mRNA_transcr_time_end_head=NULL;
     state->mRNA_transcr_time_end_tail=NULL;
-    /*mRNA_transl_init_time_end*/
-    temp1=state->mRNA_transl_init_time_end_head;
-    while(temp1){
-            temp2=temp1;
-            temp1=temp1->next;            
-            free(temp2);	
-    }
     state->mRNA_transl_init_time_end_head=NULL;
     state->mRNA_transl_init_time_end_tail=NULL;
-    /*burn_in_growth_rate_end*/
-    temp1=state->burn_in_growth_rate_head;
-    while(temp1){
-            temp2=temp1;
-            temp1=temp1->next;            
-            free(temp2);	
-    }
     state->burn_in_growth_rate_head=NULL;
     state->burn_in_growth_rate_tail=NULL;
-    /*change_singal_strength_head*/
-    temp1=state->change_signal_strength_head;
-    while(temp1){
-            temp2=temp1;
-            temp1=temp1->next;            
-            free(temp2);	
-    }
-    state->change_signal_strength_head=NULL;
-    state->change_signal_strength_tail=NULL;
-    /*sampling*/
-    temp1=state->sampling_point_end_head;
-    while(temp1){
-            temp2=temp1;
-            temp1=temp1->next;            
-            free(temp2);	
-    }
     state->sampling_point_end_head=NULL;
     state->sampling_point_end_tail=NULL;
+    event_pool.current_slab=event_pool.first_slab;
+    event_pool.N_used_in_current_slab=0;
+    event_pool.free_list=NULL;
+}
+
+/*
+ * Free the slabs of the calling thread's pool of FixedEvents, and return how many 
+ * events were allocated and how many slabs were malloc'ed since the last call
+ */
+void release_fixed_event_pool(long *N_events_allocated, long *N_slabs_allocated)
+{
+    FixedEventSlab *slab, *next_slab;
+    slab=event_pool.first_slab;
+    while(slab)
+    {
+        next_slab=slab->next;
+        free(slab);
+        slab=next_slab;
+    }
+    *N_events_allocated=event_pool.N_events_allocated;
+    *N_slabs_allocated=event_pool.N_slabs_allocated;
+    event_pool.first_slab=NULL;
+    event_pool.current_slab=NULL;
+    event_pool.N_used_in_current_slab=0;
+    event_pool.free_list=NULL;
+    event_pool.N_events_allocated=0;
+    event_pool.N_slabs_allocated=0;
 }
 
 /**returns 0 if new fixed event won't happen concurrently with any exisiting event*/
 int check_concurrence(CellState *state, float t) 
 {   
+    int i;
     FixedEvent *pointer;
     pointer=state->mRNA_transl_init_time_end_head;
     while(pointer!=NULL)
@@ -247,19 +299,15 @@ int check_concurrence(CellState *state, float t)
             return 1;
         pointer=pointer->next;
     }
-    pointer=state->signal_on_head;
-    while(pointer!=NULL)
+    for(i=state->next_signal_on;i<state->signal_schedule->N_signal_on;i++)
     {
-        if(t==pointer->time)            
+        if(t==state->t_burn_in+state->signal_schedule->t_signal_on[i])
             return 1;
-        pointer=pointer->next;
     }
-    pointer=state->signal_off_head;
-    while(pointer!=NULL)
+    for(i=state->next_signal_off;i<state->signal_schedule->N_signal_off;i++)
     {
-        if(t==pointer->time)            
+        if(t==state->t_burn_in+state->signal_schedule->t_signal_off[i])
             return 1;
-        pointer=pointer->next;
     }
     pointer=state->burn_in_growth_rate_head;
     while(pointer!=NULL)
@@ -268,12 +316,10 @@ int check_concurrence(CellState *state, float t)
             return 1;
         pointer=pointer->next;
     }
-    pointer=state->change_signal_strength_head;
-    while(pointer!=NULL)
+    for(i=state->next_signal_change;i<state->signal_schedule->N_signal_change;i++)
     {
-        if(t==pointer->time)            
+        if(t==state->signal_schedule->t_signal_change[i])
             return 1;
-        pointer=pointer->next;
     }
     pointer=state->sampling_point_end_head;
     while(pointer!=NULL)
@@ -287,6 +333,15 @@ int check_concurrence(CellState *state, float t)
     return 0;
 }
 
+/*find the times of the next events in signal_schedule*/
+void update_next_signal_events(CellState *state)
+{
+    SignalSchedule *schedule=state->signal_schedule;
+    state->t_next_signal_off=(state->next_signal_off<schedule->N_signal_off)?state->t_burn_in+schedule->t_signal_off[state->next_signal_off]:TIME_INFINITY;
+    state->t_next_signal_on=(state->next_signal_on<schedule->N_signal_on)?state->t_burn_in+schedule->t_signal_on[state->next_signal_on]:TIME_INFINITY;
+    state->t_next_signal_change=(state->next_signal_change<schedule->N_signal_change)?schedule->t_signal_change[state->next_signal_change]:TIME_INFINITY;
+}
+
 void release_memory(Genotype *resident,Genotype *mutant, RngStream *RS_main, RngStream RS_parallel[N_THREADS])
 {
     int i;    
@@ -299,4 +354,122 @@ void release_memory(Genotype *resident,Genotype *mutant, RngStream *RS_main, Rng
     
     for(i=0;i<N_THREADS;i++)
         RngStream_DeleteStream(&(RS_parallel[i])); 
+#if IRREG_SIGNAL
+    munmap(signal_profiles.mapped_file,signal_profiles.mapped_size);
+#endif
+}
+
+#if IRREG_SIGNAL
+/*
+ * Convert signal profiles from text to the binary format read by load_signal_profiles.
+ * The text starts with the number of profiles and the number of time points in a profile, 
+ * followed by the signal strength at each time point (one minute apart), profile after profile.
+ * A text without these two numbers is read in the earlier format: profiles of 
+ * LEGACY_SIGNAL_TIME_POINTS values, as many as the file holds.
+ * Returns 0 if successful.
+ */
+int convert_signal_profiles(char *text_file, char *binary_file)
+{
+    FILE *fp_in, *fp_out;
+    int header[2];
+    int flag_header;
+    long i, N_values;
+    float strength, first_two[2];
+    
+    fp_in=fopen(text_file,"r");
+    if(fp_in==NULL)
+        return 1;
+    /*count the values to tell whether the file has a header*/
+    N_values=0;
+    while(fscanf(fp_in,"%f",&strength)==1)
+    {
+        if(N_values<2)
+            first_two[N_values]=strength;
+        N_values++;
+    }
+    if(N_values>=2 && first_two[0]>0.0 && first_two[1]>0.0 &&
+        first_two[0]==(float)(int)first_two[0] && first_two[1]==(float)(int)first_two[1] &&
+        N_values-2==(long)first_two[0]*(long)first_two[1])
+    {
+        flag_header=1;
+        header[0]=(int)first_two[0];
+        header[1]=(int)first_two[1];
+    }
+    else if(N_values!=0 && N_values%LEGACY_SIGNAL_TIME_POINTS==0)
+    {
+        flag_header=0;
+        header[0]=(int)(N_values/LEGACY_SIGNAL_TIME_POINTS);
+        header[1]=LEGACY_SIGNAL_TIME_POINTS;
+        printf("%s has no header. Reading it as %d profiles of %d time points.\n",text_file,header[0],header[1]);
+    }
+    else
+    {
+        fclose(fp_in);
+        return 1;
+    }
+    rewind(fp_in);
+    if(flag_header) //skip the header
+        fscanf(fp_in,"%f %f",&first_two[0],&first_two[1]);
+    fp_out=fopen(binary_file,"wb");
+    if(fp_out==NULL)
+    {
+        fclose(fp_in);
+        return 1;
+    }
+    fwrite(SIGNAL_PROFILE_MAGIC,sizeof(char),8,fp_out);
+    fwrite(header,sizeof(int),2,fp_out);
+    N_values=(long)header[0]*header[1];
+    for(i=0;i<N_values;i++)
+    {
+        if(fscanf(fp_in,"%f",&strength)!=1)
+            break;
+        fwrite(&strength,sizeof(float),1,fp_out);
+    }
+    fclose(fp_in);
+    fclose(fp_out);
+    if(i<N_values) //the text is shorter than expected
+    {
+        remove(binary_file);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Map binary signal profiles into memory. The mapping is read-only and shared by all threads.
+ * Returns 0 if successful.
+ */
+int load_signal_profiles(char *binary_file, SignalProfiles *profiles)
+{
+    int fd;
+    int *header;
+    struct stat file_info;
+    
+    fd=open(binary_file,O_RDONLY);
+    if(fd==-1)
+        return 1;
+    if(fstat(fd,&file_info)==-1 || file_info.st_size<SIGNAL_PROFILE_HEADER_SIZE)
+    {
+        close(fd);
+        return 1;
+    }
+    profiles->mapped_size=(size_t)file_info.st_size;
+    profiles->mapped_file=mmap(NULL,profiles->mapped_size,PROT_READ,MAP_SHARED,fd,0);
+    close(fd); //the mapping stays valid
+    if(profiles->mapped_file==MAP_FAILED)
+        return 1;
+    header=(int *)((char *)profiles->mapped_file+8);
+    profiles->N_profiles=header[0];
+    profiles->N_time_points=header[1];
+    profiles->strength=(float *)((char *)profiles->mapped_file+SIGNAL_PROFILE_HEADER_SIZE);
+    if(memcmp(profiles->mapped_file,SIGNAL_PROFILE_MAGIC,8)!=0 || 
+        profiles->N_profiles<=0 || 
+        profiles->N_time_points<=0 ||
+        profiles->mapped_size!=SIGNAL_PROFILE_HEADER_SIZE+(size_t)profiles->N_profiles*profiles->N_time_points*sizeof(float))
+    {
+        munmap(profiles->mapped_file,profiles->mapped_size);
+        return 1;
+    }
+    return 0;
 }
+#endif
@@ -30,8 +30,22 @@ void delete_fixed_event_from_head(FixedEvent **, FixedEvent **);
 
 int check_concurrence(CellState *, float);
 
+void update_next_signal_events(CellState *);
+
 void free_fixedevent(CellState *);
 
+void release_fixed_event_pool(long *, long *);
+
 void release_memory(Genotype*, Genotype *, RngStream *, RngStream[N_THREADS]);
 
+#if IRREG_SIGNAL
+#define SIGNAL_PROFILE_MAGIC "NSSIGNL1"  /* the first 8 bytes of a binary signal profile */
+#define SIGNAL_PROFILE_HEADER_SIZE 16    /* magic, number of profiles, number of time points */
+#define LEGACY_SIGNAL_TIME_POINTS 90     /* a signal.txt without header holds profiles of 90 values */
+
+int convert_signal_profiles(char *, char *);
+
+int load_signal_profiles(char *, SignalProfiles *);
+#endif
+
 #endif
@@ -15,6 +15,7 @@
  * along with network-evolution-simulator. If not, see <https://www.gnu.org/licenses/>.
  */
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include "netsim.h"
 #include "RngStream.h"
@@ -25,6 +26,10 @@ char mutation_file[32];
 char setup_summary[32];
 char evo_summary[32];
 
+#if IRREG_SIGNAL
+SignalProfiles signal_profiles;
+#endif
+
 int main()
 {
     /*default output directory*/  
@@ -127,32 +132,28 @@ int main()
     selection.env2.t_signal_off=200.0; //after being "on" for the initial 10 minutes, the signal is off for 200 minutes, i.e. remains off in env2.   
     /*Alternatively, an irregular signal can be specified with an extra file*/    
 #if IRREG_SIGNAL
-    int j,k;  
-    /*The signal will be stored in signal_profile_matrix[A][B][C] (see netsim.h). 
-     *1. The signal is specified by signal strength at each of the C time points. C is 90 by default, corresponding 
-     *to the 90 minutes of simulation time.
-     *2. B is the number of signals that must be provided; each developmental simulation will chooses one from the B signals.
-     *The signals don't have to be different. The default value of B is 100.  
-     *3. A is the number of parallel threads; each thread needs a copy of the 100 signals.   
-    */  
-    /*This is the default external signal profile*/
-    /*The file should have 90*100 rows. Every 90 rows are the strength of a signal at each time point.*/
-    fp=fopen("signal.txt","r"); 
-    
-    /*load signal*/
-    if(fp!=NULL)
-    {        
-        for(j=0;j<100;j++)
-        {
-            for(k=0;k<90;k++)
-            {           
-                fscanf(fp,"%f\n",&(signal_profile_matrix[0][j][k]));
-                for(i=1;i<N_THREADS;i++)
-                    signal_profile_matrix[i][j][k]=signal_profile_matrix[0][j][k];                    
-            }
-        }
-        fclose(fp);
-    } 
+    /*The signals are read from signal.bin, which holds any number of profiles of the same length. 
+     *Each developmental simulation chooses one of them. A profile gives the signal strength every minute, 
+     *so it must cover t_development. If signal.bin does not exist, it is converted from signal.txt (see readme).
+     */
+    if(access("signal.bin",F_OK)!=0 && convert_signal_profiles("signal.txt","signal.bin")!=0)
+    {
+        printf("Converting signal.txt failed! Quit program!");
+#if MAKE_LOG
+        LOG("Converting signal.txt failed!");
+#endif
+        exit(-2);
+    }
+    if(load_signal_profiles("signal.bin",&signal_profiles)!=0 || 
+        signal_profiles.N_time_points<selection.env1.t_development ||
+        signal_profiles.N_time_points<selection.env2.t_development)
+    {
+        printf("Loading signal.bin failed! Quit program!");
+#if MAKE_LOG
+        LOG("Loading signal.bin failed!");
+#endif
+        exit(-2);
+    }
 #endif    
     
     /*Set when the effector is beneficial and when it is deleterious*/
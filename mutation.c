@@ -220,6 +220,16 @@ void reproduce_substitution(Genotype *genotype, Mutation *mut_record)
     AllTFBindingSites *container;   
     /*get the mutated gene from record*/
     which_gene=mut_record->which_gene;
+    Genome= &genotype->cisreg_seq[0][0];    
+    /* If the gene does not share its cis-reg with other genes, the substitution cannot change 
+     * cisreg_cluster, so only mark the binding sites for recalculation.
+     */
+    if(genotype->cisreg_cluster[genotype->which_cluster[which_gene]][1]==NA)
+    {
+        Genome[mut_record->which_nucleotide]=mut_record->nuc_diff[1]; 
+        genotype->recalc_TFBS[which_gene]=YES;
+        return;
+    }
     /*calculate and store the distribution of binding sites before mutation*/
     calc_all_binding_sites_copy(genotype,which_gene);
     container = malloc(genotype->N_allocated_elements*sizeof(AllTFBindingSites));
@@ -231,7 +241,6 @@ void reproduce_substitution(Genotype *genotype, Mutation *mut_record)
         container[i].mis_match=genotype->all_binding_sites[which_gene][i].mis_match;
     }
     /*apply the mutation from record*/
-    Genome= &genotype->cisreg_seq[0][0];    
     Genome[mut_record->which_nucleotide]=mut_record->nuc_diff[1]; 
     /*compare binding site bf and aft substitution to decide whether to update cisreg_cluster*/
     calc_all_binding_sites_copy(genotype,which_gene);    
@@ -819,12 +828,26 @@ void reproduce_mut_binding_sequence(Genotype *genotype, Mutation *mut_record)
         case 't':
             tf_seq_rc[CONSENSUS_SEQ_LEN-which_nucleotide-1]='a'; break;
     }     
-    for(i=0;i<genotype->ngenes;i++)
-        genotype->recalc_TFBS[i]=YES;
-    calc_all_binding_sites(genotype);
     int new_clusters[MAX_GENES][MAX_GENES],genes_in_cluster[MAX_GENES];
     int N_genes_in_cluster,no_difference,reference_gene,gene_to_be_sorted;
     int N_new_clusters,N_genes_in_new_cluster,j,k;
+    /* Only clusters of more than 1 gene can be split, so only the binding sites of their genes 
+     * are needed now. The rest are recalculated when the genotype is scored.
+     */
+    i=N_SIGNAL_TF;
+    while(genotype->cisreg_cluster[i][0]!=NA)
+    {
+        if(genotype->cisreg_cluster[i][1]!=NA)
+        {
+            j=0;
+            while(genotype->cisreg_cluster[i][j]!=NA)
+            {
+                calc_all_binding_sites_copy(genotype,genotype->cisreg_cluster[i][j]);
+                j++;
+            }
+        }
+        i++;
+    }
     i=N_SIGNAL_TF;
     while(genotype->cisreg_cluster[i][0]!=NA)
     {        
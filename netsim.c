@@ -21,6 +21,7 @@
 #include <stdlib.h>
 #include <math.h>
 #include <string.h>
+#include <stddef.h>
 #include <omp.h>
 #include "netsim.h"
 #include "cellular_activity.h"
@@ -28,6 +29,18 @@
 #include "numerical.h"
 #include "lib.h"
 #include "RngStream.h"
+#include <unistd.h>
+#include <sys/types.h>
+#if ASYNC_OUTPUT
+#include <pthread.h>
+#endif
+#if COMPRESS_MUTANT_LOGS
+#include <zlib.h>
+#endif
+#if PHENOTYPE && BINARY_TIMECOURSE
+#include <fcntl.h>
+#include <sys/mman.h>
+#endif
 
 #define INITIALIZATION -1
 
@@ -71,6 +84,196 @@ const int MIN_GENE_LENGTH= 50; //aa
 int N_TF_GENES=MAX_TF_GENES;
 int N_EFFECTOR_GENES=MAX_EFFECTOR_GENES;
 
+/*output files that are appended to during evolution. Their sizes are recorded at every saving point*/
+#define N_OUTPUT_FILES 17
+
+#if BINARY_CHECKPOINT
+/*checkpoint.bin starts with a CheckpointHeader, which is followed by the resident genotype,
+ *the mutation record, RS_main, and RS_parallel[0] to RS_parallel[N_THREADS-1]*/
+#define CHECKPOINT_VERSION 2
+typedef struct CheckpointHeader CheckpointHeader;
+struct CheckpointHeader
+{
+    char magic[8];                              /* "NSCHKPNT" */
+    int version;
+    int size_of_genotype;                       /* a checkpoint can only be loaded by a simulator built with the same knobs */
+    int size_of_rng_stream;
+    int n_threads;
+    int step;
+    int N_tot_trials;
+    int max_TFBS_number;
+    int N_output_files;
+    long file_size[N_OUTPUT_FILES];             /* size of the output files at the checkpoint, -1 if a file does not exist */
+};
+#endif
+
+#if BINARY_OUTPUT
+/*a column of residents.bin or mutants.bin, and the field of Output_buffer it stores.
+ *A column of type 's' stores an int field in 2 bytes*/
+typedef struct RecordField RecordField;
+struct RecordField
+{
+    char *name;
+    char type;
+    int count;
+    size_t offset_in_buffer;
+};
+#define RECORD_FIELD(field,type,count) {#field,type,count,offsetof(Output_buffer,field)}
+/*columns of residents.bin, in the order they appear in the text files*/
+static const RecordField resident_fields[]=
+{
+    RECORD_FIELD(step,'i',1),
+    RECORD_FIELD(n_tot_mut,'i',1),
+    RECORD_FIELD(n_mut_at_the_step,'i',1),
+    RECORD_FIELD(n_hit_bound,'i',1),
+    RECORD_FIELD(mut_type,'c',1),
+    RECORD_FIELD(which_gene,'s',1),
+    RECORD_FIELD(which_nuc,'s',1),
+    RECORD_FIELD(new_nuc,'c',3),
+    RECORD_FIELD(which_kinetic,'s',1),
+    RECORD_FIELD(new_kinetic,'f',1),
+    RECORD_FIELD(selection_coefficient,'f',1),
+    RECORD_FIELD(avg_f,'f',1),
+    RECORD_FIELD(f1,'f',1),
+    RECORD_FIELD(f2,'f',1),
+    RECORD_FIELD(se_avg_f,'f',1),
+    RECORD_FIELD(se_f1,'f',1),
+    RECORD_FIELD(se_f2,'f',1),
+#if STRATIFIED_BURN_IN || ANTITHETIC_REPLICATES
+    RECORD_FIELD(variance_reduction,'f',1),
+#endif
+#if ADAPTIVE_HI_RESOLUTION
+    RECORD_FIELD(n_replicates,'i',1),
+#endif
+    RECORD_FIELD(n_gene,'s',1),
+    RECORD_FIELD(n_effector_genes,'s',1),
+    RECORD_FIELD(n_act,'s',1),
+    RECORD_FIELD(n_rep,'s',1),
+    RECORD_FIELD(n_motifs,'s',36),
+#if COUNT_NEAR_AND
+    RECORD_FIELD(n_near_AND_gated_motifs,'s',12),
+#endif
+};
+/*columns of mutants.bin*/
+static const RecordField mutant_fields[]=
+{
+    RECORD_FIELD(step,'i',1),
+    RECORD_FIELD(n_tot_mut,'i',1),
+    RECORD_FIELD(mut_type,'c',1),
+    RECORD_FIELD(which_gene,'s',1),
+    RECORD_FIELD(which_nuc,'s',1),
+    RECORD_FIELD(new_nuc,'c',3),
+    RECORD_FIELD(which_kinetic,'s',1),
+    RECORD_FIELD(new_kinetic,'f',1),
+    RECORD_FIELD(avg_f,'f',1),
+    RECORD_FIELD(f1,'f',1),
+    RECORD_FIELD(f2,'f',1),
+    RECORD_FIELD(se_avg_f,'f',1),
+    RECORD_FIELD(se_f1,'f',1),
+    RECORD_FIELD(se_f2,'f',1),
+#if COMMON_RANDOM_NUMBERS
+    RECORD_FIELD(avg_f_diff,'f',1),
+    RECORD_FIELD(se_avg_f_diff,'f',1),
+#endif
+#if STRATIFIED_BURN_IN || ANTITHETIC_REPLICATES
+    RECORD_FIELD(variance_reduction,'f',1),
+#endif
+#if MEAN_FIELD_PRESCREEN
+    RECORD_FIELD(mean_field_f,'f',1),
+    RECORD_FIELD(mean_field_resident_f,'f',1),
+    RECORD_FIELD(screened_out,'i',1),
+#endif
+};
+#undef RECORD_FIELD
+#endif
+
+#if ASYNC_OUTPUT
+/*The records of an OUTPUT_INTERVAL and a copy of the state to be saved at its end. 
+ *evolve_N_steps fills one job while the writer thread writes the other*/
+typedef struct OutputJob OutputJob;
+struct OutputJob
+{
+    int step;                                   /* the last step of the interval */
+    int N_tot_trials;
+    int flag_saving_point;                      /* 0 at the end of burn-in, whose last step is output by run_simulation */
+    Output_buffer resident_info[OUTPUT_INTERVAL];
+    int N_resident_records;
+    Output_buffer *mutant_info;                 /* preallocated, and only grows */
+    int mutant_info_size;
+    int N_mutant_records;
+    Genotype resident;                          /* all_binding_sites point to arrays owned by the job */
+    int N_allocated_binding_sites;
+    unsigned long rng_seeds[N_SAVED_PARALLEL_STREAMS+1][6];
+#if BINARY_CHECKPOINT
+    Mutation mut_record;
+    struct RngStream_InfoState rng_states[N_THREADS+1];
+    int max_TFBS_number;
+#endif
+};
+
+static OutputJob output_jobs[2];
+static int job_being_filled=0;
+static int job_to_write=0;
+static int job_pending=0;                       /* 1 from submitting a job until the writer has written it */
+static int writer_quit=0;
+static pthread_t writer_thread;
+static pthread_mutex_t writer_lock=PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_cond=PTHREAD_COND_INITIALIZER;
+#endif
+
+#if TOPOLOGY_STREAM
+static Topology last_topology;                  /* the last network in topology.bin */
+static int N_deltas_since_keyframe=-1;          /* -1 until last_topology is read from topology.bin */
+#endif
+
+#if INCREMENTAL_MOTIF_COUNT && !PERTURB && !SAMPLE_PARAMETERS
+/*the motifs counted at an effector cluster, and the fingerprint of what they were counted from*/
+typedef struct MotifCache MotifCache;
+struct MotifCache
+{
+    int valid;
+    unsigned long long fingerprint;
+    int N_motifs[36];
+    int N_near_AND_gated_motifs[12];
+};
+
+static MotifCache motif_cache[MAX_GENES];     /* indexed by fingerprint%MAX_GENES */
+#endif
+
+#if PHENOTYPE && AGGREGATE_EXPRESSION
+#define N_QUANTILES 5
+static const double QUANTILES[N_QUANTILES]={0.05,0.25,0.5,0.75,0.95};
+
+/*P-square estimate of a quantile (Jain and Chlamtac 1985). It keeps 5 markers instead of the samples*/
+typedef struct QuantileSketch QuantileSketch;
+struct QuantileSketch
+{
+    double height[5];                           /* the first 5 samples, sorted, until there are 5 */
+    double position[5];
+    double desired_position[5];
+};
+
+/*statistics over replicates of each variable at each time point. The variables are fitness, 
+ *the proteins and then the genes*/
+typedef struct ExpressionStats ExpressionStats;
+struct ExpressionStats
+{
+    int N_variables;
+    int N_time_points;
+    int *N_samples;                             /* [variable][time point] */
+    double *mean;
+    double *sum_sq_deviation;                   /* M2 of Welford's algorithm */
+    QuantileSketch *sketch;                     /* [variable][time point][quantile] */
+};
+#endif
+
+#if PHENOTYPE && BINARY_TIMECOURSE
+/*timecourse.bin starts with "NSTIMEC1", nproteins, ngenes, N_REPLICATES, and total_time_points under env A and B,
+ *followed by the number of time points sampled in each replicate (int [2][N_REPLICATES]).
+ *The rest are floats [env][replicate][series][time point], where the series are fitness, the proteins, and then the genes*/
+#define TIMECOURSE_HEADER_SIZE (8+(5+2*N_REPLICATES)*sizeof(int))
+#endif
+
 /******************************************************************************
  * 
  *                     Private function prototypes
@@ -80,16 +283,40 @@ static void initialize_sequence(char *, int, int, RngStream);
 
 static void initialize_genotype_fixed(Genotype *, int, int, int, RngStream);
 
-static void set_signal(CellState *, Environment *, float, RngStream, int);
+static void build_signal_schedule(SignalSchedule *, Environment *);
+
+static void free_signal_schedule(SignalSchedule *);
 
-static void calc_avg_fitness(Genotype *, Selection *, int [MAX_GENES], float [MAX_PROTEINS], RngStream [N_THREADS], float *, float *); 
+static void set_signal(CellState *, Environment *, SignalSchedule *, float, RngStream);
+
+static void calc_avg_fitness(Genotype *, Selection *, int [MAX_GENES], float [MAX_PROTEINS], RngStream [N_THREADS], float *, float *, int); 
+
+static void calc_fitness_stats(Genotype *, Selection *, float (*)[N_REPLICATES], float (*)[N_REPLICATES], int, float *, float *);
+
+#if COMMON_RANDOM_NUMBERS
+static void skip_used_substreams(RngStream [N_THREADS]);
+#endif
+
+#if STRATIFIED_BURN_IN
+static float draw_stratified_burn_in_time(Environment *, int, RngStream);
+#endif
+
+#if STRATIFIED_BURN_IN || ANTITHETIC_REPLICATES
+static float calc_sq_SE_of_batch(float *);
+#endif
 
-static void calc_fitness_stats(Genotype *, Selection *, float (*)[N_REPLICATES], float (*)[N_REPLICATES], int);
+#if MEAN_FIELD_PRESCREEN
+static float calc_mean_field_avg_fitness(Genotype *, Selection *, int [MAX_GENES], float [MAX_PROTEINS]);
+#endif
 
 static void try_replacement(Genotype *, Genotype *, int *, float*);
 
 static void clone_genotype(Genotype *, Genotype *);
 
+#if LUMP_IDENTICAL_COPIES && !PHENOTYPE
+static void lump_identical_copies(Genotype *, int [MAX_GENES], float [MAX_GENES]);
+#endif
+
 static void summarize_binding_sites(Genotype *,int);
 
 static int evolve_N_steps(Genotype *, Genotype *,  Mutation *, Selection *, Output_buffer [OUTPUT_INTERVAL], int *, int *, int [MAX_GENES], float [MAX_PROTEINS], RngStream, RngStream [N_THREADS], int);
@@ -98,10 +325,16 @@ static void run_simulation(Genotype *, Genotype *, Mutation *, Selection *, Sele
 
 static void continue_simulation(Genotype *, Genotype *, Mutation *, Selection *, Selection *, int, int [MAX_GENES], float [MAX_PROTEINS], RngStream, RngStream [N_THREADS]);
 
-static void replay_mutations(Genotype *, Mutation *, int);
+static void replay_mutations(Genotype *, Mutation *, int, int);
 
 static void find_motifs(Genotype *);
 
+#if INCREMENTAL_MOTIF_COUNT && !PERTURB && !SAMPLE_PARAMETERS
+static void add_to_fingerprint(unsigned long long *, const void *, size_t);
+
+static unsigned long long fingerprint_effector_cluster(Genotype *, int, int);
+#endif
+
 static int find_TFBS_of_A_on_B(Genotype *, int, int);
 
 static void find_activators_of_effector(Genotype *, int, int *, int [MAX_PROTEINS]);
@@ -120,6 +353,80 @@ static void determine_near_AND_logic(Genotype *, int [MAX_PROTEINS][2][50], int,
 
 static void tidy_output_files(char*, char*);
 
+static void list_output_files(char *[N_OUTPUT_FILES]);
+
+static void measure_output_files(long [N_OUTPUT_FILES]);
+
+static void truncate_output_files(long [N_OUTPUT_FILES]);
+
+static void write_saving_point(int, int);
+
+static int read_output_file_sizes(long [N_OUTPUT_FILES]);
+
+#if BINARY_CHECKPOINT || INDEXED_MUTATION_LOG
+static void write_genotype(FILE *, Genotype *);
+#endif
+
+#if BINARY_CHECKPOINT || (INDEXED_MUTATION_LOG && (PHENOTYPE || PERTURB))
+static void read_genotype(FILE *, Genotype *);
+#endif
+
+#if INDEXED_MUTATION_LOG
+static void append_mutations(Output_buffer *, int);
+
+static void save_genotype_snapshot(Genotype *, int);
+
+#if PHENOTYPE || PERTURB
+static FILE *open_mutation_log(int);
+
+static int read_mutation(FILE *, Mutation *);
+
+static void reconstruct_genotype(Genotype *, Mutation *, int);
+#endif
+#endif
+
+#if BINARY_CHECKPOINT
+static void save_checkpoint(Genotype *, Mutation *, int, int, int, RngStream, RngStream [N_THREADS]);
+
+static int load_checkpoint(Genotype *, Mutation *, int, int *, RngStream, RngStream [N_THREADS]);
+#endif
+
+#if ASYNC_OUTPUT
+static void start_output_writer(void);
+
+static void submit_output_job(Genotype *, Mutation *, Output_buffer [OUTPUT_INTERVAL], int, int, int, int, int, RngStream, RngStream [N_THREADS]);
+
+static void stop_output_writer(void);
+
+static void *run_output_writer(void *);
+
+static void write_output_job(OutputJob *);
+#endif
+
+#if PHENOTYPE && BINARY_TIMECOURSE
+static char *map_timecourse(Genotype *, Selection *, Phenotype [N_REPLICATES], Phenotype [N_REPLICATES], size_t *);
+
+static void unmap_timecourse(char *, size_t, Phenotype [N_REPLICATES], Phenotype [N_REPLICATES]);
+#endif
+
+#if PHENOTYPE && AGGREGATE_EXPRESSION
+static void init_expression_stats(ExpressionStats *, int, int);
+
+static void add_to_sketch(QuantileSketch *, double, int, double);
+
+static double read_sketch(QuantileSketch *, double, int);
+
+static double calc_sketch_CDF(QuantileSketch *, int, double);
+
+static double read_merged_sketches(ExpressionStats [N_THREADS], int, int);
+
+static void add_timecourse_to_stats(ExpressionStats *, Phenotype *, int);
+
+static void write_expression_stats(ExpressionStats [N_THREADS], char *, int);
+
+static void free_expression_stats(ExpressionStats *);
+#endif
+
 static void print_motifs(Genotype *);
 
 static void store_mutant_info(Genotype *, Mutation *, Output_buffer *, int, int);
@@ -130,6 +437,22 @@ static void output_mutant_info(Output_buffer *, int);
 
 static void output_resident_info(Output_buffer [OUTPUT_INTERVAL], int, int);
 
+#if BINARY_OUTPUT
+static void write_records(char *, const RecordField *, int, Output_buffer *, int);
+#endif
+
+#if COMPRESS_MUTANT_LOGS
+static long append_compressed_block(char *, char *, size_t);
+#endif
+
+#if TOPOLOGY_STREAM
+static void append_topology(Topology *, int);
+
+static void read_last_topology(void);
+
+static int read_topology(FILE *, Topology *, int *);
+#endif
+
 static void sample_motifs(Genotype *, Mutation *, int, RngStream);
 
 static void sample_parameters(Genotype *, int, RngStream);
@@ -193,6 +516,9 @@ int evolve_under_selection(Genotype *resident,
         /* record the initial network topology*/
         init_step=0;
         summarize_binding_sites(resident,init_step); /*snapshot of the initial (0) distribution binding sites */   
+#if INDEXED_MUTATION_LOG
+        save_genotype_snapshot(resident,init_step);
+#endif
         find_motifs(resident); 
         print_motifs(resident);           
 
@@ -201,14 +527,14 @@ int evolve_under_selection(Genotype *resident,
         if(burn_in->MAX_STEPS!=0)
         {
             for(i=0;i<HI_RESOLUTION_RECALC;i++)  
-                calc_avg_fitness(resident, burn_in, init_mRNA, init_protein, RS_parallel, GR1[i], GR2[i]);
-            calc_fitness_stats(resident,burn_in,&(GR1[0]),&(GR2[0]),HI_RESOLUTION_RECALC); 
+                calc_avg_fitness(resident, burn_in, init_mRNA, init_protein, RS_parallel, GR1[i], GR2[i], i);
+            calc_fitness_stats(resident,burn_in,&(GR1[0]),&(GR2[0]),HI_RESOLUTION_RECALC,NULL,NULL); 
         }
         else
         {
             for(i=0;i<HI_RESOLUTION_RECALC;i++)  
-                calc_avg_fitness(resident, selection, init_mRNA, init_protein, RS_parallel, GR1[i], GR2[i]);  
-            calc_fitness_stats(resident,selection,&(GR1[0]),&(GR2[0]),HI_RESOLUTION_RECALC); 
+                calc_avg_fitness(resident, selection, init_mRNA, init_protein, RS_parallel, GR1[i], GR2[i], i);  
+            calc_fitness_stats(resident,selection,&(GR1[0]),&(GR2[0]),HI_RESOLUTION_RECALC,NULL,NULL); 
         }
        
         /* make title of the output file*/
@@ -337,7 +663,15 @@ void show_phenotype(Genotype *resident, Mutation *mut_record, Selection *selecti
     /*replay mutations, output N_motifs.txt and networks.txt*/   
     if(REPRODUCE_GENOTYPES || SAMPLE_GENE_EXPRESSION)
     {        
-        replay_mutations(resident, mut_record, selection->MAX_STEPS);    
+#if INDEXED_MUTATION_LOG
+        /*only the evolved genotype is needed to sample gene expression, which is rebuilt from the nearest snapshot*/
+        if(REPRODUCE_GENOTYPES)
+            replay_mutations(resident, mut_record, selection->MAX_STEPS, !LAZY_REPLAY);
+        else
+            reconstruct_genotype(resident, mut_record, selection->MAX_STEPS);
+#else
+        replay_mutations(resident, mut_record, selection->MAX_STEPS, !LAZY_REPLAY);    
+#endif
         /*output the evolved genotype*/
         calc_all_binding_sites(resident); 
         print_mutatable_parameters(resident,1);
@@ -351,7 +685,7 @@ void show_phenotype(Genotype *resident, Mutation *mut_record, Selection *selecti
         /*collection interval is 1 minute by default*/    
         selection->env1.t_development=91.1; //to make 90 data points
         selection->env2.t_development=91.1; 
-        calc_avg_fitness(resident, selection, init_mRNA, init_protein, RS_parallel, NULL, NULL);  
+        calc_avg_fitness(resident, selection, init_mRNA, init_protein, RS_parallel, NULL, NULL, 0);  
     }
 }
 
@@ -362,6 +696,11 @@ static void sample_motifs(Genotype *genotype_ori,
                             RngStream RS)
 {
     int i,N_samples,which_step;    
+#if INDEXED_MUTATION_LOG
+    Genotype genotype_copy2;
+    (void)genotype_ori; //sampled genotypes are rebuilt from genotypes.bin
+    initialize_cache(&genotype_copy2);
+#else
     Genotype genotype_copy1, genotype_copy2;
     initialize_cache(&genotype_copy1); 
     initialize_cache(&genotype_copy2);
@@ -401,14 +740,22 @@ static void sample_motifs(Genotype *genotype_ori,
     }
     /*close mutation_file*/    
     fclose(fp);  
+#endif
     /*reset N_samples*/
     N_samples=0;    
     /*sampling repeatedly*/
     while(N_samples<SAMPLE_SIZE)
     {
+#if !INDEXED_MUTATION_LOG
         /*Keep the genotype at the last (x-1)th step intact*/
         clone_genotype(&genotype_copy1,&genotype_copy2);  
+#endif
         which_step=RngStream_RandInt(RS,1,max_step-START_STEP_OF_SAMPLING+1);
+#if INDEXED_MUTATION_LOG
+        /*rebuild the genotype at which_step from the nearest snapshot*/
+        reconstruct_genotype(&genotype_copy2,mut_record,START_STEP_OF_SAMPLING-1+which_step);
+        i=which_step;
+#else
         /*open mutation record and skip the entries before start_step*/
         fp=fopen(mutation_file,"r");
         for(i=0;i<START_STEP_OF_SAMPLING-1;i++)
@@ -424,6 +771,7 @@ static void sample_motifs(Genotype *genotype_ori,
                                                         &(mut_record->kinetic_diff));
             reproduce_mutate(&genotype_copy2,mut_record); 
         } 
+#endif
         /*score motifs*/
 		calc_all_binding_sites(&genotype_copy2); 
         find_motifs(&genotype_copy2); 
@@ -455,8 +803,10 @@ static void sample_motifs(Genotype *genotype_ori,
                         N_samples++;
                     }                
         }      
+#if !INDEXED_MUTATION_LOG
         /*close mutation record*/
         fclose(fp);   
+#endif
     }
     printf("Sampling parameters successfully!\n");
 }
@@ -596,6 +946,11 @@ void perturbation_analysis(Genotype *resident,
     float fitness1[HI_RESOLUTION_RECALC][N_REPLICATES],fitness2[HI_RESOLUTION_RECALC][N_REPLICATES]; 
     FILE *file_mutation,*fitness_record,*f_aft_perturbation,*f_bf_perturbation;  
     
+#if INDEXED_MUTATION_LOG
+    /*start from the genotype before START_STEP_OF_PERTURBATION, which is rebuilt from the nearest snapshot*/
+    reconstruct_genotype(resident,mut_record,START_STEP_OF_PERTURBATION-1);
+    file_mutation=open_mutation_log(START_STEP_OF_PERTURBATION);
+#else
     /*load mutation record*/
     file_mutation=fopen(mutation_file,"r");    
     if(file_mutation!=NULL)        
@@ -608,16 +963,27 @@ void perturbation_analysis(Genotype *resident,
 #endif
         exit(-2);
     } 
+#endif
     
     /*skip first 2 rows of fitness_record*/
     fitness_record=fopen(evo_summary,"r");
     fgets(buffer,600,fitness_record);
     fgets(buffer,600,fitness_record);   
+#if INDEXED_MUTATION_LOG
+    /*and the rows of the steps that are not replayed*/
+    for(i=1;i<START_STEP_OF_PERTURBATION;i++)
+        fgets(buffer,600,fitness_record);
+#endif
     
     /*create threads*/
     omp_set_num_threads(N_THREADS);
     
     /*begin*/
+#if INDEXED_MUTATION_LOG
+    for(i=START_STEP_OF_PERTURBATION;i<=selection->MAX_STEPS;i++)
+    { 
+        read_mutation(file_mutation,mut_record);
+#else
     for(i=1;i<=selection->MAX_STEPS;i++)
     { 
         fscanf(file_mutation,"%c %d %d %s %d %a\n",&(mut_record->mut_type),
@@ -626,6 +992,7 @@ void perturbation_analysis(Genotype *resident,
                                                     mut_record->nuc_diff,               
                                                     &(mut_record->kinetic_type),
                                                     &(mut_record->kinetic_diff));
+#endif
         reproduce_mutate(resident,mut_record);
         fscanf(fitness_record,"%d %d %d %d %c %f %f %f %f %f %f %f %d %d %d %d\n",
                 &step,
@@ -671,8 +1038,8 @@ void perturbation_analysis(Genotype *resident,
 #endif             
             {
                 for(j=0;j<HI_RESOLUTION_RECALC;j++) 
-                    calc_avg_fitness(resident, selection, init_mRNA, init_protein, RS_parallel, fitness1[j], fitness2[j]);                
-                calc_fitness_stats(resident, selection, &(fitness1[0]), &(fitness2[0]), HI_RESOLUTION_RECALC);  
+                    calc_avg_fitness(resident, selection, init_mRNA, init_protein, RS_parallel, fitness1[j], fitness2[j], j);                
+                calc_fitness_stats(resident, selection, &(fitness1[0]), &(fitness2[0]), HI_RESOLUTION_RECALC, NULL, NULL);  
                 f_aft_perturbation=fopen("f_aft_perturbation.txt","a+");
                 fprintf(f_aft_perturbation,"%d %.10f %.10f %.10f %.10f %.10f %.10f\n",i,
                         resident->avg_fitness,                        
@@ -1096,40 +1463,55 @@ void calc_all_binding_sites(Genotype *genotype)
 }
 
 /*
- * Set how the environmental signal should change
+ * Build the schedule of signal changes in an environment. 
  */
-static void set_signal(CellState *state, Environment *env, float t_burn_in, RngStream RS, int thread_ID)
+static void build_signal_schedule(SignalSchedule *schedule, Environment *env)
 {
-    float t=0.0;     
-    char flag;   
+    int pass;
+    float t;
+#if !IRREG_SIGNAL
+    char flag;
+#endif
     
+    schedule->t_signal_off=NULL;
+    schedule->t_signal_on=NULL;
+    schedule->t_signal_change=NULL;
+    /*the first pass counts the events, the second one records them*/
+    for(pass=0;pass<2;pass++)
+    {
+        if(pass==1)
+        {
+            schedule->t_signal_off=(float *)malloc((schedule->N_signal_off+1)*sizeof(float));
+            schedule->t_signal_on=(float *)malloc((schedule->N_signal_on+1)*sizeof(float));
+            schedule->t_signal_change=(float *)malloc((schedule->N_signal_change+1)*sizeof(float));
+        }
+        schedule->N_signal_off=0;
+        schedule->N_signal_on=0;
+        schedule->N_signal_change=0;
 #if IRREG_SIGNAL
-    int j;
-    j=RngStream_RandInt(RS,0,99);
-    env->external_signal=&(signal_profile_matrix[thread_ID][j][0]);
+        /*an external signal changes every minute*/
+        t=1.0;
+        while(t<env->t_development)
+        {
+            if(pass==1)
+                schedule->t_signal_change[schedule->N_signal_change]=t;
+            schedule->N_signal_change++;
+            t+=1.0;
+        } 
 #else
-    env->external_signal=NULL;             
-#endif    
-    
-    if(env->external_signal==NULL)   
-    {
-        /*always start a burn-in with signal off*/       
-        state->protein_number[N_SIGNAL_TF-1]=0.0; 
-        if(t_burn_in!=0.0)
-            t=t+t_burn_in; //the completion of burn_in is a fixed event, which is added in initialize_cell       
         /*after burn-in, signal should be turned "o"n*/
+        t=0.0;
         flag='o'; 
-#if N_SIGNAL_TF==2
-        state->protein_number[0]=background_signal_strength;
-#endif      
-        while(t<env->t_development+t_burn_in)
+        while(t<env->t_development)
         {
             if(flag=='o')
             {                
                 if(env->t_signal_on!=0.0) 
                 {
-                    /*add a fixed event to TURN OFF signal.*/
-                    add_fixed_event(-1,t+env->t_signal_on,&(state->signal_off_head),&(state->signal_off_tail));
+                    /*TURN OFF signal.*/
+                    if(pass==1)
+                        schedule->t_signal_off[schedule->N_signal_off]=t+env->t_signal_on;
+                    schedule->N_signal_off++;
                     t=t+env->t_signal_on; 
                 }
                 flag='f';                                  
@@ -1138,26 +1520,57 @@ static void set_signal(CellState *state, Environment *env, float t_burn_in, RngS
             {
                 if(env->t_signal_off!=0.0)
                 {
-                    /*add when to TURN ON signal*/
-                    add_fixed_event(-1,t+env->t_signal_off,&(state->signal_on_head),&(state->signal_on_tail));
+                    /*TURN ON signal*/
+                    if(pass==1)
+                        schedule->t_signal_on[schedule->N_signal_on]=t+env->t_signal_off;
+                    schedule->N_signal_on++;
                     t=t+env->t_signal_off;
                 }
                 flag='o';                
             }
         } 
+#endif
     }
-    else
+}
+
+static void free_signal_schedule(SignalSchedule *schedule)
+{
+    free(schedule->t_signal_off);
+    free(schedule->t_signal_on);
+    free(schedule->t_signal_change);
+}
+
+/*
+ * Set how the environmental signal should change
+ */
+static void set_signal(CellState *state, Environment *env, SignalSchedule *schedule, float t_burn_in, RngStream RS)
+{
+#if IRREG_SIGNAL
+    int j;
+    j=RngStream_RandInt(RS,0,signal_profiles.N_profiles-1);
+    env->external_signal=&(signal_profiles.strength[j*signal_profiles.N_time_points]);
+#else
+    env->external_signal=NULL;             
+#endif    
+    
+    /*the replicate reads the events of the schedule from the beginning*/
+    state->signal_schedule=schedule;
+    state->t_burn_in=t_burn_in;
+    state->next_signal_off=0;
+    state->next_signal_on=0;
+    state->next_signal_change=0;
+    update_next_signal_events(state);
+    
+    if(env->external_signal==NULL)   
     {
-        int time_point=1;
-        state->protein_number[N_SIGNAL_TF-1]=env->external_signal[0];
-        t=1.0;
-        while(t<env->t_development)
-        {
-            add_fixed_event(time_point,t,&(state->change_signal_strength_head),&(state->change_signal_strength_tail));
-            time_point++;
-            t+=1.0;
-        } 
+        /*always start a burn-in with signal off*/       
+        state->protein_number[N_SIGNAL_TF-1]=0.0; 
+#if N_SIGNAL_TF==2
+        state->protein_number[0]=background_signal_strength;
+#endif      
     }
+    else
+        state->protein_number[N_SIGNAL_TF-1]=env->external_signal[0];
 }
 
 
@@ -1271,58 +1684,556 @@ static void clone_genotype(Genotype *genotype_templet, Genotype *genotype_clone)
     genotype_clone->total_loci_length=genotype_templet->total_loci_length;   
 }
 
-/**
- *Calculate the fintess of a given genotype.
- *Essentially calling do_single_timestep until tdevelopment and calculate 
- *average fitness over tdevelopment.
+#if LUMP_IDENTICAL_COPIES && !PHENOTYPE
+/*
+ * Copies of a gene that share cis-reg sequence, protein and kinetic constants are 
+ * exchangeable in a simulation. This keeps only the first copy in the genotype, and
+ * records in N_copies how many copies it stands for. The states of their promoters are
+ * then counted together, and mRNA and protein numbers are pooled. 
+ * Only the clone of a genotype that is simulated in calc_avg_fitness should be lumped.
  */
-static void calc_avg_fitness(   Genotype *genotype,
-                                Selection *Selection,
-                                int init_mRNA[MAX_GENES],
-                                float init_protein_number[MAX_PROTEINS],
-                                RngStream RS_parallel[N_THREADS], 
-                                float Fitness1[N_REPLICATES],
-                                float Fitness2[N_REPLICATES])       
-{   
-    Phenotype timecourse1[N_REPLICATES], timecourse2[N_REPLICATES]; 
-#if PHENOTYPE     
-    int i,j;   
-    /*alloc space and initialize values to 0.0*/
-    for(i=0;i<N_REPLICATES;i++)
+static void lump_identical_copies(Genotype *genotype, int mRNA[MAX_GENES], float protein[MAX_GENES])
+{
+    int i, j, k, N_kept_genes, N_kept_tf_genes, N_genes_in_list;
+    int new_id[MAX_GENES], is_first_copy[MAX_GENES];
+    int gene_list[MAX_GENES];
+    AllTFBindingSites *temp;
+    
+    /*find out which copies are identical to an earlier copy*/
+    N_kept_genes=N_SIGNAL_TF;
+    N_kept_tf_genes=N_SIGNAL_TF;
+    for(i=0;i<N_SIGNAL_TF;i++)
     {
-        timecourse1[i].total_time_points=(int)(Selection->env1.t_development+Selection->env1.max_duration_of_burn_in_growth_rate);
-        timecourse1[i].gene_specific_concentration=(float *)malloc(timecourse1[i].total_time_points*genotype->ngenes*sizeof(float));
-        timecourse1[i].protein_concentration=(float *)malloc(timecourse1[i].total_time_points*genotype->nproteins*sizeof(float));
-        timecourse1[i].instantaneous_fitness=(float *)malloc(timecourse1[i].total_time_points*sizeof(float));
-        timecourse1[i].timepoint=0;
-        for(j=0;j<timecourse1[i].total_time_points*genotype->ngenes;j++)
-            timecourse1[i].gene_specific_concentration[j]=0.0;
-        for(j=0;j<timecourse1[i].total_time_points*genotype->nproteins;j++)
-            timecourse1[i].protein_concentration[j]=0.0;
-        for(j=0;j<timecourse1[i].total_time_points;j++)
-            timecourse1[i].instantaneous_fitness[j]=0.0;
-        /*do the same to timecourse2*/
-        timecourse2[i].total_time_points=(int)(Selection->env2.t_development+Selection->env2.max_duration_of_burn_in_growth_rate);
-        timecourse2[i].gene_specific_concentration=(float *)malloc(timecourse2[i].total_time_points*genotype->ngenes*sizeof(float));
-        timecourse2[i].protein_concentration=(float *)malloc(timecourse2[i].total_time_points*genotype->nproteins*sizeof(float));
-        timecourse2[i].instantaneous_fitness=(float *)malloc(timecourse2[i].total_time_points*sizeof(float));
-        timecourse2[i].timepoint=0;
-        for(j=0;j<timecourse2[i].total_time_points*genotype->ngenes;j++)
-            timecourse2[i].gene_specific_concentration[j]=0.0;
-        for(j=0;j<timecourse2[i].total_time_points*genotype->nproteins;j++)
-            timecourse2[i].protein_concentration[j]=0.0;
-        for(j=0;j<timecourse2[i].total_time_points;j++)
-            timecourse2[i].instantaneous_fitness[j]=0.0;
-        timecourse1[i].max_change_in_probability_of_binding=0.0;
-        timecourse2[i].max_change_in_probability_of_binding=0.0;
-    }        
+        new_id[i]=i;
+        is_first_copy[i]=1;
+    }
+    for(i=N_SIGNAL_TF;i<genotype->ngenes;i++)
+    {
+        for(j=N_SIGNAL_TF;j<i;j++)
+        {
+            if(is_first_copy[j] &&
+                genotype->which_cluster[j]==genotype->which_cluster[i] &&
+                genotype->which_protein[j]==genotype->which_protein[i] &&
+                genotype->locus_length[j]==genotype->locus_length[i] &&
+                genotype->mRNA_decay_rate[j]==genotype->mRNA_decay_rate[i] &&
+                genotype->protein_decay_rate[j]==genotype->protein_decay_rate[i] &&
+                genotype->translation_rate[j]==genotype->translation_rate[i] &&
+                genotype->active_to_intermediate_rate[j]==genotype->active_to_intermediate_rate[i] &&
+                genotype->min_N_activator_to_transc[j]==genotype->min_N_activator_to_transc[i])
+                break;
+        }
+        if(j<i)
+        {
+            new_id[i]=new_id[j];
+            is_first_copy[i]=0;
+        }
+        else
+        {
+            new_id[i]=N_kept_genes;
+            is_first_copy[i]=1;
+            N_kept_genes++;
+            if(i<genotype->ntfgenes)
+                N_kept_tf_genes++;
+        }
+    }
+    if(N_kept_genes==genotype->ngenes)
+        return;
+    
+    /*move the first copies forward and pool the others into them. Because new_id[i]<=i, 
+     *gene i has not been overwritten when it is visited*/
+    for(i=N_SIGNAL_TF;i<genotype->ngenes;i++)
+    {
+        k=new_id[i];
+        if(is_first_copy[i])
+        {
+            if(k!=i)
+            {
+                genotype->which_protein[k]=genotype->which_protein[i];
+                genotype->which_cluster[k]=genotype->which_cluster[i];
+                memcpy(&genotype->cisreg_seq[k][0],&genotype->cisreg_seq[i][0],CISREG_LEN*sizeof(char));
+                genotype->recalc_TFBS[k]=genotype->recalc_TFBS[i];
+                genotype->locus_length[k]=genotype->locus_length[i];
+                genotype->mRNA_decay_rate[k]=genotype->mRNA_decay_rate[i];
+                genotype->protein_decay_rate[k]=genotype->protein_decay_rate[i];
+                genotype->translation_rate[k]=genotype->translation_rate[i];
+                genotype->active_to_intermediate_rate[k]=genotype->active_to_intermediate_rate[i];
+                genotype->min_N_activator_to_transc[k]=genotype->min_N_activator_to_transc[i];
+                genotype->binding_sites_num[k]=genotype->binding_sites_num[i];
+                for(j=0;j<3;j++)
+                    genotype->max_unhindered_sites[k][j]=genotype->max_unhindered_sites[i][j];
+                genotype->max_hindered_sites[k]=genotype->max_hindered_sites[i];
+                genotype->N_act_BS[k]=genotype->N_act_BS[i];
+                genotype->N_rep_BS[k]=genotype->N_rep_BS[i];
+                /*swap, so that every allocated array is still freed with the clone*/
+                temp=genotype->all_binding_sites[k];
+                genotype->all_binding_sites[k]=genotype->all_binding_sites[i];
+                genotype->all_binding_sites[i]=temp;
+                mRNA[k]=mRNA[i];
+                protein[k]=protein[i];
+            }
+            genotype->N_copies[k]=1;
+        }
+        else
+        {
+            genotype->N_copies[k]++;
+            mRNA[k]+=mRNA[i];
+            protein[k]+=protein[i];
+        }
+    }
+    
+    /*renumber genes in protein_pool and cisreg_cluster, listing each kept gene once*/
+    for(i=0;i<genotype->nproteins;i++)
+    {
+        N_genes_in_list=0;
+        for(j=0;j<genotype->protein_pool[i][0][0];j++)
+        {
+            k=new_id[genotype->protein_pool[i][1][j]];
+            if(is_first_copy[genotype->protein_pool[i][1][j]])
+                gene_list[N_genes_in_list++]=k;
+        }
+        for(j=0;j<genotype->protein_pool[i][0][0];j++)
+            genotype->protein_pool[i][1][j]=(j<N_genes_in_list)?gene_list[j]:NA;
+        genotype->protein_pool[i][0][0]=N_genes_in_list;
+    }
+    i=0;
+    while(genotype->cisreg_cluster[i][0]!=NA)
+    {
+        N_genes_in_list=0;
+        j=0;
+        while(genotype->cisreg_cluster[i][j]!=NA)
+        {
+            if(is_first_copy[genotype->cisreg_cluster[i][j]])
+                gene_list[N_genes_in_list++]=new_id[genotype->cisreg_cluster[i][j]];
+            j++;
+        }
+        for(k=0;k<j;k++)
+            genotype->cisreg_cluster[i][k]=(k<N_genes_in_list)?gene_list[k]:NA;
+        i++;
+    }
+    genotype->ngenes=N_kept_genes;
+    genotype->ntfgenes=N_kept_tf_genes;
+}
 #endif
 
-    /*Making clones of a genotype, and have the clones run in parallel*/
-    #pragma omp parallel num_threads(N_THREADS) 
+#if PHENOTYPE && AGGREGATE_EXPRESSION
+static void init_expression_stats(ExpressionStats *stats, int N_variables, int N_time_points)
+{
+    int N_cells=N_variables*N_time_points;
+    stats->N_variables=N_variables;
+    stats->N_time_points=N_time_points;
+    stats->N_samples=(int *)calloc(N_cells,sizeof(int));
+    stats->mean=(double *)calloc(N_cells,sizeof(double));
+    stats->sum_sq_deviation=(double *)calloc(N_cells,sizeof(double));
+    stats->sketch=(QuantileSketch *)calloc(N_cells*N_QUANTILES,sizeof(QuantileSketch));
+    if(stats->N_samples==NULL || stats->mean==NULL || stats->sum_sq_deviation==NULL || stats->sketch==NULL)
+    {
+        printf("Cannot allocate memory for expression statistics! Quit program!\n");
+#if MAKE_LOG
+        LOG("Cannot allocate memory for expression statistics\n");
+#endif
+        exit(-2);
+    }
+}
+
+/*add x to the sketch of the p quantile, which has N samples*/
+static void add_to_sketch(QuantileSketch *sketch, double p, int N, double x)
+{
+    int i,k;
+    double d,h,increment[5]={0.0,p/2.0,p,(1.0+p)/2.0,1.0};
+    
+    if(N<5)
+    {
+        /*insertion sort the first 5 samples*/
+        i=N;
+        while(i>0 && sketch->height[i-1]>x)
+        {
+            sketch->height[i]=sketch->height[i-1];
+            i--;
+        }
+        sketch->height[i]=x;
+        if(N==4)
+        {
+            for(i=0;i<5;i++)
+            {
+                sketch->position[i]=(double)i;
+                sketch->desired_position[i]=4.0*increment[i];
+            }
+        }
+        return;
+    }
+    /*find the cell of x, and extend the extreme markers if needed*/
+    if(x<sketch->height[0])
+    {
+        sketch->height[0]=x;
+        k=0;
+    }
+    else if(x>=sketch->height[4])
+    {
+        sketch->height[4]=x;
+        k=3;
+    }
+    else
+    {
+        k=0;
+        while(x>=sketch->height[k+1])
+            k++;
+    }
+    for(i=k+1;i<5;i++)
+        sketch->position[i]+=1.0;
+    for(i=0;i<5;i++)
+        sketch->desired_position[i]+=increment[i];
+    /*move the middle markers toward their desired positions*/
+    for(i=1;i<4;i++)
+    {
+        d=sketch->desired_position[i]-sketch->position[i];
+        if((d>=1.0 && sketch->position[i+1]-sketch->position[i]>1.0) || (d<=-1.0 && sketch->position[i-1]-sketch->position[i]<-1.0))
+        {
+            d=(d>0.0)?1.0:-1.0;
+            /*piecewise-parabolic prediction*/
+            h=sketch->height[i]+d/(sketch->position[i+1]-sketch->position[i-1])*
+                    ((sketch->position[i]-sketch->position[i-1]+d)*(sketch->height[i+1]-sketch->height[i])/(sketch->position[i+1]-sketch->position[i])+
+                     (sketch->position[i+1]-sketch->position[i]-d)*(sketch->height[i]-sketch->height[i-1])/(sketch->position[i]-sketch->position[i-1]));
+            if(sketch->height[i-1]<h && h<sketch->height[i+1])
+                sketch->height[i]=h;
+            else /*linear prediction*/
+            {
+                k=i+(int)d;
+                sketch->height[i]+=d*(sketch->height[k]-sketch->height[i])/(sketch->position[k]-sketch->position[i]);
+            }
+            sketch->position[i]+=d;
+        }
+    }
+}
+
+static double read_sketch(QuantileSketch *sketch, double p, int N)
+{
+    if(N==0)
+        return 0.0;
+    if(N<5)
+        return sketch->height[(int)(p*(N-1)+0.5)];
+    return sketch->height[2];
+}
+
+/*fraction of the N samples of a sketch that are below x, interpolated between the markers*/
+static double calc_sketch_CDF(QuantileSketch *sketch, int N, double x)
+{
+    int i,N_markers=(N<5)?N:5;
+    double position;
+    
+    if(N==0 || x<sketch->height[0])
+        return 0.0;
+    if(x>=sketch->height[N_markers-1])
+        return 1.0;
+    i=0;
+    while(x>=sketch->height[i+1])
+        i++;
+    if(N<5) //the markers are the samples
+        position=(double)i+(x-sketch->height[i])/(sketch->height[i+1]-sketch->height[i]);
+    else
+        position=sketch->position[i]+(x-sketch->height[i])/(sketch->height[i+1]-sketch->height[i])*(sketch->position[i+1]-sketch->position[i]);
+    return position/(N-1);
+}
+
+/*the q-th quantile of a cell over the replicates of all threads. The distribution of the 
+ *replicates is the mixture of the distributions given by the sketches of the threads, 
+ *which is inverted by bisection*/
+static double read_merged_sketches(ExpressionStats stats[N_THREADS], int cell, int q)
+{
+    int i,j,N_markers,N_total=0,N_threads_with_samples=0,last_thread=0;
+    double x_min=0.0,x_max=0.0,x,F;
+    QuantileSketch *sketch;
+    
+    for(i=0;i<N_THREADS;i++)
+    {
+        if(stats[i].N_samples[cell]==0)
+            continue;
+        sketch=&(stats[i].sketch[cell*N_QUANTILES+q]);
+        N_markers=(stats[i].N_samples[cell]<5)?stats[i].N_samples[cell]:5;
+        if(N_threads_with_samples==0 || sketch->height[0]<x_min)
+            x_min=sketch->height[0];
+        if(N_threads_with_samples==0 || sketch->height[N_markers-1]>x_max)
+            x_max=sketch->height[N_markers-1];
+        N_total+=stats[i].N_samples[cell];
+        N_threads_with_samples++;
+        last_thread=i;
+    }
+    if(N_threads_with_samples<=1)
+        return read_sketch(&(stats[last_thread].sketch[cell*N_QUANTILES+q]),QUANTILES[q],stats[last_thread].N_samples[cell]);
+    for(j=0;j<50;j++)
+    {
+        x=0.5*(x_min+x_max);
+        F=0.0;
+        for(i=0;i<N_THREADS;i++)
+            F+=stats[i].N_samples[cell]*calc_sketch_CDF(&(stats[i].sketch[cell*N_QUANTILES+q]),stats[i].N_samples[cell],x);
+        if(F/N_total<QUANTILES[q])
+            x_min=x;
+        else
+            x_max=x;
+    }
+    return 0.5*(x_min+x_max);
+}
+
+/*Called by a thread after it has simulated a replicate into its own timecourse. Each thread 
+ *keeps its own statistics, which are merged by write_expression_stats*/
+static void add_timecourse_to_stats(ExpressionStats *stats, Phenotype *timecourse, int nproteins)
+{
+    int i,k,q,cell;
+    double x,delta;
+    
+    for(i=0;i<stats->N_variables;i++)
+    {
+        /*timepoint is advanced once more after the last sample*/
+        for(k=0;k<timecourse->timepoint-1 && k<stats->N_time_points;k++)
+        {
+            if(i==0)
+                x=timecourse->instantaneous_fitness[k];
+            else if(i<=nproteins)
+                x=timecourse->protein_concentration[(i-1)*timecourse->total_time_points+k];
+            else
+                x=timecourse->gene_specific_concentration[(i-1-nproteins)*timecourse->total_time_points+k];
+            cell=i*stats->N_time_points+k;
+            for(q=0;q<N_QUANTILES;q++)
+                add_to_sketch(&(stats->sketch[cell*N_QUANTILES+q]),QUANTILES[q],stats->N_samples[cell],x);
+            /*Welford's algorithm*/
+            stats->N_samples[cell]++;
+            delta=x-stats->mean[cell];
+            stats->mean[cell]+=delta/stats->N_samples[cell];
+            stats->sum_sq_deviation[cell]+=delta*(x-stats->mean[cell]);
+        }
+    }
+}
+
+/*Merge the statistics of the threads, in the order of threads, and write them. 
+ *Each row is a variable at a time point*/
+static void write_expression_stats(ExpressionStats stats[N_THREADS], char *file_name, int nproteins)
+{
+    int i,j,k,q,cell,N;
+    double mean,sum_sq_deviation,delta;
+    FILE *fp;
+    fp=fopen(file_name,"w");
+    if(fp==NULL)
+    {
+        printf("Cannot write %s! Quit program!\n",file_name);
+#if MAKE_LOG
+        LOG("Cannot write %s\n",file_name);
+#endif
+        exit(-2);
+    }
+    fprintf(fp,"variable time_point N mean variance");
+    for(q=0;q<N_QUANTILES;q++)
+        fprintf(fp," q%g",QUANTILES[q]);
+    fprintf(fp,"\n");
+    for(i=0;i<stats[0].N_variables;i++)
+    {
+        for(k=0;k<stats[0].N_time_points;k++)
+        {
+            cell=i*stats[0].N_time_points+k;
+            /*pairwise update of mean and M2 (Chan et al. 1979)*/
+            N=0;
+            mean=0.0;
+            sum_sq_deviation=0.0;
+            for(j=0;j<N_THREADS;j++)
+            {
+                if(stats[j].N_samples[cell]==0)
+                    continue;
+                delta=stats[j].mean[cell]-mean;
+                mean+=delta*stats[j].N_samples[cell]/(N+stats[j].N_samples[cell]);
+                sum_sq_deviation+=stats[j].sum_sq_deviation[cell]+delta*delta*N*stats[j].N_samples[cell]/(N+stats[j].N_samples[cell]);
+                N+=stats[j].N_samples[cell];
+            }
+            if(N==0)
+                continue;
+            if(i==0)
+                fprintf(fp,"fitness ");
+            else if(i<=nproteins)
+                fprintf(fp,"protein%d ",i-1);
+            else
+                fprintf(fp,"gene%d ",i-1-nproteins);
+            fprintf(fp,"%d %d %f %f",k,N,mean,(N>1)?sum_sq_deviation/(N-1):0.0);
+            for(q=0;q<N_QUANTILES;q++)
+                fprintf(fp," %f",read_merged_sketches(stats,cell,q));
+            fprintf(fp,"\n");
+        }
+    }
+    fclose(fp);
+}
+
+static void free_expression_stats(ExpressionStats *stats)
+{
+    free(stats->N_samples);
+    free(stats->mean);
+    free(stats->sum_sq_deviation);
+    free(stats->sketch);
+}
+#endif
+
+#if PHENOTYPE && BINARY_TIMECOURSE
+/*Create timecourse.bin and point the timecourses of all replicates into it. 
+ *The file is created with zeros, so unsampled time points need not be initialized*/
+static char *map_timecourse(Genotype *genotype, Selection *selection, Phenotype timecourse1[N_REPLICATES], Phenotype timecourse2[N_REPLICATES], size_t *mapped_size)
+{
+    int fd,i,N_series,total_time_points[2];
+    int *header;
+    char *mapped_file;
+    float *data;
+    
+    N_series=1+genotype->nproteins+genotype->ngenes;
+    total_time_points[0]=(int)(selection->env1.t_development+selection->env1.max_duration_of_burn_in_growth_rate);
+    total_time_points[1]=(int)(selection->env2.t_development+selection->env2.max_duration_of_burn_in_growth_rate);
+    *mapped_size=TIMECOURSE_HEADER_SIZE+(size_t)N_REPLICATES*N_series*(total_time_points[0]+total_time_points[1])*sizeof(float);
+    fd=open("timecourse.bin",O_RDWR|O_CREAT|O_TRUNC,0644);
+    if(fd==-1 || ftruncate(fd,(off_t)*mapped_size)==-1)
+    {
+        printf("Cannot create timecourse.bin! Quit program!\n");
+#if MAKE_LOG
+        LOG("Cannot create timecourse.bin\n");
+#endif
+        exit(-2);
+    }
+    mapped_file=mmap(NULL,*mapped_size,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+    close(fd); //the mapping stays valid
+    if(mapped_file==MAP_FAILED)
+    {
+        printf("Cannot map timecourse.bin! Quit program!\n");
+#if MAKE_LOG
+        LOG("Cannot map timecourse.bin\n");
+#endif
+        exit(-2);
+    }
+    memcpy(mapped_file,"NSTIMEC1",8);
+    header=(int *)(mapped_file+8);
+    header[0]=genotype->nproteins;
+    header[1]=genotype->ngenes;
+    header[2]=N_REPLICATES;
+    header[3]=total_time_points[0];
+    header[4]=total_time_points[1];
+    data=(float *)(mapped_file+TIMECOURSE_HEADER_SIZE);
+    for(i=0;i<N_REPLICATES;i++)
+    {
+        timecourse1[i].total_time_points=total_time_points[0];
+        timecourse1[i].instantaneous_fitness=data+(size_t)i*N_series*total_time_points[0];
+        timecourse1[i].protein_concentration=timecourse1[i].instantaneous_fitness+total_time_points[0];
+        timecourse1[i].gene_specific_concentration=timecourse1[i].protein_concentration+genotype->nproteins*total_time_points[0];
+        timecourse1[i].timepoint=0;
+        timecourse1[i].max_change_in_probability_of_binding=0.0;
+    }
+    data+=(size_t)N_REPLICATES*N_series*total_time_points[0];
+    for(i=0;i<N_REPLICATES;i++)
+    {
+        timecourse2[i].total_time_points=total_time_points[1];
+        timecourse2[i].instantaneous_fitness=data+(size_t)i*N_series*total_time_points[1];
+        timecourse2[i].protein_concentration=timecourse2[i].instantaneous_fitness+total_time_points[1];
+        timecourse2[i].gene_specific_concentration=timecourse2[i].protein_concentration+genotype->nproteins*total_time_points[1];
+        timecourse2[i].timepoint=0;
+        timecourse2[i].max_change_in_probability_of_binding=0.0;
+    }
+    return mapped_file;
+}
+
+/*record the number of time points sampled in each replicate, and write timecourse.bin*/
+static void unmap_timecourse(char *mapped_file, size_t mapped_size, Phenotype timecourse1[N_REPLICATES], Phenotype timecourse2[N_REPLICATES])
+{
+    int i;
+    int *N_sampled=(int *)(mapped_file+8+5*sizeof(int));
+    /*timepoint is advanced once more after the last sample*/
+    for(i=0;i<N_REPLICATES;i++)
+    {
+        N_sampled[i]=timecourse1[i].timepoint-1;
+        N_sampled[N_REPLICATES+i]=timecourse2[i].timepoint-1;
+    }
+    munmap(mapped_file,mapped_size);
+}
+#endif
+
+/**
+ *Calculate the fintess of a given genotype.
+ *Essentially calling do_single_timestep until tdevelopment and calculate 
+ *average fitness over tdevelopment.
+ */
+static void calc_avg_fitness(   Genotype *genotype,
+                                Selection *Selection,
+                                int init_mRNA[MAX_GENES],
+                                float init_protein_number[MAX_PROTEINS],
+                                RngStream RS_parallel[N_THREADS], 
+                                float Fitness1[N_REPLICATES],
+                                float Fitness2[N_REPLICATES],
+                                int which_batch)       
+{   
+    Phenotype timecourse1[N_REPLICATES], timecourse2[N_REPLICATES]; 
+    SignalSchedule signal_schedule1, signal_schedule2;
+    long N_fixed_events=0, N_fixed_event_slabs=0;
+#if PHENOTYPE     
+    int i;   
+#if AGGREGATE_EXPRESSION
+    ExpressionStats stats1[N_THREADS], stats2[N_THREADS];
+    float max_change1[N_REPLICATES], max_change2[N_REPLICATES];
+#endif
+#if BINARY_TIMECOURSE
+    char *timecourse_file;
+    size_t timecourse_file_size;
+    timecourse_file=map_timecourse(genotype, Selection, timecourse1, timecourse2, &timecourse_file_size);
+#else
+    int j,N_timecourses;
+#if AGGREGATE_EXPRESSION
+    /*each thread keeps one timecourse, which is added to the statistics of the thread after every replicate*/
+    N_timecourses=N_THREADS;
+#else
+    N_timecourses=N_REPLICATES;
+#endif
+    /*alloc space and initialize values to 0.0*/
+    for(i=0;i<N_timecourses;i++)
+    {
+        timecourse1[i].total_time_points=(int)(Selection->env1.t_development+Selection->env1.max_duration_of_burn_in_growth_rate);
+        timecourse1[i].gene_specific_concentration=(float *)malloc(timecourse1[i].total_time_points*genotype->ngenes*sizeof(float));
+        timecourse1[i].protein_concentration=(float *)malloc(timecourse1[i].total_time_points*genotype->nproteins*sizeof(float));
+        timecourse1[i].instantaneous_fitness=(float *)malloc(timecourse1[i].total_time_points*sizeof(float));
+        timecourse1[i].timepoint=0;
+        for(j=0;j<timecourse1[i].total_time_points*genotype->ngenes;j++)
+            timecourse1[i].gene_specific_concentration[j]=0.0;
+        for(j=0;j<timecourse1[i].total_time_points*genotype->nproteins;j++)
+            timecourse1[i].protein_concentration[j]=0.0;
+        for(j=0;j<timecourse1[i].total_time_points;j++)
+            timecourse1[i].instantaneous_fitness[j]=0.0;
+        /*do the same to timecourse2*/
+        timecourse2[i].total_time_points=(int)(Selection->env2.t_development+Selection->env2.max_duration_of_burn_in_growth_rate);
+        timecourse2[i].gene_specific_concentration=(float *)malloc(timecourse2[i].total_time_points*genotype->ngenes*sizeof(float));
+        timecourse2[i].protein_concentration=(float *)malloc(timecourse2[i].total_time_points*genotype->nproteins*sizeof(float));
+        timecourse2[i].instantaneous_fitness=(float *)malloc(timecourse2[i].total_time_points*sizeof(float));
+        timecourse2[i].timepoint=0;
+        for(j=0;j<timecourse2[i].total_time_points*genotype->ngenes;j++)
+            timecourse2[i].gene_specific_concentration[j]=0.0;
+        for(j=0;j<timecourse2[i].total_time_points*genotype->nproteins;j++)
+            timecourse2[i].protein_concentration[j]=0.0;
+        for(j=0;j<timecourse2[i].total_time_points;j++)
+            timecourse2[i].instantaneous_fitness[j]=0.0;
+        timecourse1[i].max_change_in_probability_of_binding=0.0;
+        timecourse2[i].max_change_in_probability_of_binding=0.0;
+    }        
+#endif
+#if AGGREGATE_EXPRESSION
+    for(i=0;i<N_THREADS;i++)
+    {
+        init_expression_stats(&(stats1[i]), 1+genotype->nproteins+genotype->ngenes, timecourse1[0].total_time_points);
+        init_expression_stats(&(stats2[i]), 1+genotype->nproteins+genotype->ngenes, timecourse2[0].total_time_points);
+    }
+#endif
+#endif
+
+#if THREAD_INVARIANT_RNG && !COMMON_RANDOM_NUMBERS
+    /*every call moves RS_parallel[0] to fresh substreams, so batches need no offset*/
+    which_batch=0;
+#elif !COMMON_RANDOM_NUMBERS
+    (void)which_batch; //replicates continue the streams of the threads, whatever the batch
+#endif
+    /*all replicates of an environment share a schedule of signal changes*/
+    build_signal_schedule(&signal_schedule1, &(Selection->env1));
+    build_signal_schedule(&signal_schedule2, &(Selection->env2));
+    
+    /*Making clones of a genotype, and have the clones run in parallel*/
+    #pragma omp parallel num_threads(N_THREADS) 
     {
         int thread_ID=omp_get_thread_num(); 
-        int i,j,k;
+        int i,j,k,which_timecourse;
         int N_replicates_per_thread=N_REPLICATES/N_THREADS;  
         Genotype genotype_clone;
         CellState state_clone;
@@ -1334,6 +2245,34 @@ static void calc_avg_fitness(   Genotype *genotype,
         int mRNA[genotype->ngenes];
         float protein[genotype->ngenes];         
         Environment Env1, Env2;
+        RngStream RS;
+#if ANTITHETIC_REPLICATES
+        struct RngStream_InfoState pair_start;
+#endif
+#if THREAD_INVARIANT_RNG
+        struct RngStream_InfoState RS_replicates;
+        
+        /*Replicates draw from substreams of a copy of RS_parallel[0]. Replicate r of batch which_batch under env e
+         *uses substream ((2*which_batch+e)*N_REPLICATES+r)/(ANTITHETIC_REPLICATES+1), whichever thread runs it*/
+        RS_replicates=*RS_parallel[0];
+        RS=&RS_replicates;
+        RngStream_ResetStartSubstream(RS);
+        for(i=0;i<(2*which_batch*N_REPLICATES+thread_ID*N_replicates_per_thread)/(ANTITHETIC_REPLICATES+1);i++)
+            RngStream_ResetNextSubstream(RS);
+#elif COMMON_RANDOM_NUMBERS
+        struct RngStream_InfoState RS_replicates;
+        
+        /*Replicates draw from substreams of a copy of the thread's rng stream, 
+         *so that the stream itself only moves between evolutionary steps (see skip_used_substreams).
+         *Replicate i of batch which_batch under env e uses substream (2*which_batch+e)*N_replicates_per_thread+i*/
+        RS_replicates=*RS_parallel[thread_ID];
+        RS=&RS_replicates;
+        RngStream_ResetStartSubstream(RS);
+        for(i=0;i<2*which_batch*N_replicates_per_thread;i++)
+            RngStream_ResetNextSubstream(RS);
+#else
+        RS=RS_parallel[thread_ID];
+#endif
               
         /*initialize the clone*/
         initialize_cache(&genotype_clone);        
@@ -1388,6 +2327,10 @@ static void calc_avg_fitness(   Genotype *genotype,
                 protein[genotype_clone.protein_pool[j][1][k]]=(float)init_protein_number_clone[j]/genotype_clone.protein_pool[j][0][0]; //split the initial protein number equally to different copies
                                                                                                                                         //this is to make sure all proteins have equal initial numbers
         }        
+#if LUMP_IDENTICAL_COPIES && !PHENOTYPE
+        /*simulate identical copies of a gene as one gene with multiple copies*/
+        lump_identical_copies(&genotype_clone, mRNA, protein);
+#endif
         /* now calc fitness under the two environments*/
         /********************************************************************** 
          * 
@@ -1396,33 +2339,67 @@ static void calc_avg_fitness(   Genotype *genotype,
          *********************************************************************/
         for(i=0;i<N_replicates_per_thread;i++) /* env 1, usually a constant signal that matches env*/
         {
+#if ANTITHETIC_REPLICATES
+            if(i%2==0)
+                pair_start=*RS;
+#endif
+#if PHENOTYPE && AGGREGATE_EXPRESSION
+            which_timecourse=thread_ID;
+            timecourse1[which_timecourse].max_change_in_probability_of_binding=0.0;
+#else
+            which_timecourse=thread_ID*N_replicates_per_thread+i;
+#endif
             /*make a t_burn_in before turning on signal*/
+#if STRATIFIED_BURN_IN
+            t_burn_in=draw_stratified_burn_in_time(&Env1, thread_ID*N_replicates_per_thread+i, RS);
+#else
             do
-                t_burn_in=Env1.avg_duration_of_burn_in_growth_rate*expdev(RS_parallel[thread_ID]);
+                t_burn_in=Env1.avg_duration_of_burn_in_growth_rate*expdev(RS);
             while(t_burn_in>Env1.max_duration_of_burn_in_growth_rate);                
+#endif
             
             /*initialize mRNA and protein numbers, and gene states etc.*/
             initialize_cell(&genotype_clone, &state_clone, &Env1, t_burn_in, mRNA, protein);
             
             /*set how the signal should change during simulation*/
-            set_signal(&state_clone, &Env1, t_burn_in, RS_parallel[thread_ID], thread_ID);
+            set_signal(&state_clone, &Env1, &signal_schedule1, t_burn_in, RS);
             
             /*calcualte the rates of cellular activity based on the initial cellular state*/
-            calc_all_rates(&genotype_clone, &state_clone, &rate_clone, &Env1, &(timecourse1[thread_ID*N_replicates_per_thread+i]), t_burn_in, INITIALIZATION);             
+            calc_all_rates(&genotype_clone, &state_clone, &rate_clone, &Env1, &(timecourse1[which_timecourse]), t_burn_in, INITIALIZATION);             
 #if PHENOTYPE
-            timecourse1[thread_ID*N_replicates_per_thread+i].timepoint=0;
+            timecourse1[which_timecourse].timepoint=0;
 #endif
             /*run developmental simulation until tdevelopment or encounter an error*/
             while(state_clone.t<Env1.t_development+t_burn_in) 
-                do_single_timestep(&genotype_clone, &state_clone, &rate_clone, &Env1, t_burn_in, &(timecourse1[thread_ID*N_replicates_per_thread+i]), RS_parallel[thread_ID]);
+                do_single_timestep(&genotype_clone, &state_clone, &rate_clone, &Env1, t_burn_in, &(timecourse1[which_timecourse]), RS);
                       
             /*calculate average instantaneous fitness of tdevelopment*/
             f1[i]=(state_clone.cumulative_fitness-state_clone.cumulative_fitness_after_burn_in)/Env1.t_development; 
 #if PHENOTYPE
-            timecourse1[thread_ID*N_replicates_per_thread+i].timepoint++;
+            timecourse1[which_timecourse].timepoint++;
+#if AGGREGATE_EXPRESSION
+            max_change1[thread_ID*N_replicates_per_thread+i]=timecourse1[which_timecourse].max_change_in_probability_of_binding;
+            add_timecourse_to_stats(&(stats1[thread_ID]), &(timecourse1[which_timecourse]), genotype->nproteins);
+#endif
 #endif          
             /*free linked tables*/
-            free_fixedevent(&state_clone);           
+            free_fixedevent(&state_clone);  
+#if ANTITHETIC_REPLICATES
+            /*the odd replicate of a pair replays the random numbers of the even one antithetically.
+             *A pair ends at the start of a new substream, so that the state of the stream is reproducible*/
+            if(i%2==0)
+            {
+                *RS=pair_start;
+                RngStream_SetAntithetic(RS,1);
+            }
+            else
+            {
+                RngStream_SetAntithetic(RS,0);
+                RngStream_ResetNextSubstream(RS);
+            }
+#elif COMMON_RANDOM_NUMBERS || THREAD_INVARIANT_RNG
+            RngStream_ResetNextSubstream(RS);
+#endif
         }   
         
         /********************************************************************** 
@@ -1430,48 +2407,139 @@ static void calc_avg_fitness(   Genotype *genotype,
          *                              TEST2 
          *
          *********************************************************************/
+#if THREAD_INVARIANT_RNG
+        /*skip the substreams that other threads use under env 1*/
+        for(i=0;i<(N_REPLICATES-N_replicates_per_thread)/(ANTITHETIC_REPLICATES+1);i++)
+            RngStream_ResetNextSubstream(RS);
+#endif
         for(i=0;i<N_replicates_per_thread;i++) 
         {            
+#if ANTITHETIC_REPLICATES
+            if(i%2==0)
+                pair_start=*RS;
+#endif
+#if PHENOTYPE && AGGREGATE_EXPRESSION
+            which_timecourse=thread_ID;
+            timecourse2[which_timecourse].max_change_in_probability_of_binding=0.0;
+#else
+            which_timecourse=thread_ID*N_replicates_per_thread+i;
+#endif
+#if STRATIFIED_BURN_IN
+            t_burn_in=draw_stratified_burn_in_time(&Env2, thread_ID*N_replicates_per_thread+i, RS);
+#else
             do
-                t_burn_in=Env2.avg_duration_of_burn_in_growth_rate*expdev(RS_parallel[thread_ID]);
+                t_burn_in=Env2.avg_duration_of_burn_in_growth_rate*expdev(RS);
             while(t_burn_in>Env2.max_duration_of_burn_in_growth_rate); 
+#endif
             initialize_cell(&genotype_clone, &state_clone, &Env2, t_burn_in, mRNA, protein);
-            set_signal(&state_clone, &Env2, t_burn_in, RS_parallel[thread_ID], thread_ID);
-            calc_all_rates(&genotype_clone, &state_clone, &rate_clone, &Env2, &(timecourse2[thread_ID*N_replicates_per_thread+i]), t_burn_in, INITIALIZATION); 
+            set_signal(&state_clone, &Env2, &signal_schedule2, t_burn_in, RS);
+            calc_all_rates(&genotype_clone, &state_clone, &rate_clone, &Env2, &(timecourse2[which_timecourse]), t_burn_in, INITIALIZATION); 
 #if PHENOTYPE
-            timecourse2[thread_ID*N_replicates_per_thread+i].timepoint=0;
+            timecourse2[which_timecourse].timepoint=0;
 #endif            
             while(state_clone.t<Env2.t_development+t_burn_in) 
-                do_single_timestep(&genotype_clone, &state_clone, &rate_clone, &Env2, t_burn_in, &(timecourse2[thread_ID*N_replicates_per_thread+i]), RS_parallel[thread_ID]);            
+                do_single_timestep(&genotype_clone, &state_clone, &rate_clone, &Env2, t_burn_in, &(timecourse2[which_timecourse]), RS);            
         
             f2[i]=(state_clone.cumulative_fitness-state_clone.cumulative_fitness_after_burn_in)/Env2.t_development;
 #if PHENOTYPE
-            timecourse2[thread_ID*N_replicates_per_thread+i].timepoint++;
+            timecourse2[which_timecourse].timepoint++;
+#if AGGREGATE_EXPRESSION
+            max_change2[thread_ID*N_replicates_per_thread+i]=timecourse2[which_timecourse].max_change_in_probability_of_binding;
+            add_timecourse_to_stats(&(stats2[thread_ID]), &(timecourse2[which_timecourse]), genotype->nproteins);
+#endif
 #endif           
-            free_fixedevent(&state_clone);            
+            free_fixedevent(&state_clone);  
+#if ANTITHETIC_REPLICATES
+            /*the odd replicate of a pair replays the random numbers of the even one antithetically.
+             *A pair ends at the start of a new substream, so that the state of the stream is reproducible*/
+            if(i%2==0)
+            {
+                *RS=pair_start;
+                RngStream_SetAntithetic(RS,1);
+            }
+            else
+            {
+                RngStream_SetAntithetic(RS,0);
+                RngStream_ResetNextSubstream(RS);
+            }
+#elif COMMON_RANDOM_NUMBERS || THREAD_INVARIANT_RNG
+            RngStream_ResetNextSubstream(RS);
+#endif
         } 
         /*free linked tables*/
         for(j=0;j<MAX_GENES;j++)
             free(genotype_clone.all_binding_sites[j]);
+        long N_events_of_thread, N_slabs_of_thread;
+        release_fixed_event_pool(&N_events_of_thread, &N_slabs_of_thread);
        
         /*pool fitness from each thread*/
         #pragma omp critical
         {
+            N_fixed_events+=N_events_of_thread;
+            N_fixed_event_slabs+=N_slabs_of_thread;
             j=0;
-            for(i=thread_ID*N_replicates_per_thread;i<(thread_ID+1)*N_replicates_per_thread;i++)
+            /*show_phenotype does not collect fitness*/
+            if(Fitness1!=NULL)
             {
-                Fitness1[i]=f1[j];
-                Fitness2[i]=f2[j];
-                j++;
+                for(i=thread_ID*N_replicates_per_thread;i<(thread_ID+1)*N_replicates_per_thread;i++)
+                {
+                    Fitness1[i]=f1[j];
+                    Fitness2[i]=f2[j];
+                    j++;
+                }
             }
         } 
 
     }     
+    free_signal_schedule(&signal_schedule1);
+    free_signal_schedule(&signal_schedule2);
+#if FIXED_EVENT_STATS
+    FILE *fp_stats;
+    fp_stats=fopen("fixed_event_stats.txt","a");
+    if(fp_stats==NULL)
+    {
+        printf("Cannot open fixed_event_stats.txt! Quit program!\n");
+#if MAKE_LOG
+        LOG("Cannot open fixed_event_stats.txt\n");
+#endif
+        exit(-2);
+    }
+    fprintf(fp_stats,"%ld %ld\n",N_fixed_events,N_fixed_event_slabs);
+    fclose(fp_stats);
+#endif
+#if THREAD_INVARIANT_RNG && !COMMON_RANDOM_NUMBERS
+    int n;
+    for(n=0;n<2*N_REPLICATES/(ANTITHETIC_REPLICATES+1);n++)
+        RngStream_ResetNextSubstream(RS_parallel[0]);
+#endif
 #if PHENOTYPE
     /*output timecourse*/
+    FILE *fp;   
+#if AGGREGATE_EXPRESSION
+    write_expression_stats(stats1, "expression_A.txt", genotype->nproteins);
+    write_expression_stats(stats2, "expression_B.txt", genotype->nproteins);
+    for(i=0;i<N_THREADS;i++)
+    {
+        free_expression_stats(&(stats1[i]));
+        free_expression_stats(&(stats2[i]));
+    }
+    
+    /*output the maximum change in the probabilities of TF binding*/
+    fp=fopen("max_change_in_binding_probability_A.txt","w");
+    for(i=0;i<N_REPLICATES;i++)
+        fprintf(fp,"%f\n",max_change1[i]);
+    fclose(fp);
+    
+    fp=fopen("max_change_in_binding_probability_B.txt","w");
+    for(i=0;i<N_REPLICATES;i++)
+        fprintf(fp,"%f\n",max_change2[i]);
+    fclose(fp);
+#else
+#if BINARY_TIMECOURSE
+    unmap_timecourse(timecourse_file, timecourse_file_size, timecourse1, timecourse2);
+#else
     int k;
     char filename[32];
-    FILE *fp;   
     /*fitness: each row is a replicate*/
     fp=fopen("fitnessA","w");
     for(i=0;i<N_REPLICATES;i++)
@@ -1539,6 +2607,7 @@ static void calc_avg_fitness(   Genotype *genotype,
         }
         fclose(fp);
     } 
+#endif
    
     /*output the maximum change in the probabilities of TF binding*/
     fp=fopen("max_change_in_binding_probability_A.txt","w");
@@ -1550,8 +2619,10 @@ static void calc_avg_fitness(   Genotype *genotype,
     for(i=0;i<N_REPLICATES;i++)
         fprintf(fp,"%f\n",timecourse2[i].max_change_in_probability_of_binding);
     fclose(fp);      
+#endif
     
-    for(i=0;i<N_THREADS;i++)
+#if !BINARY_TIMECOURSE
+    for(i=0;i<N_timecourses;i++)
     {
         free(timecourse1[i].gene_specific_concentration);
         free(timecourse2[i].gene_specific_concentration);
@@ -1561,6 +2632,7 @@ static void calc_avg_fitness(   Genotype *genotype,
         free(timecourse2[i].protein_concentration);
     }
 #endif
+#endif
 }
 
 /*
@@ -1580,6 +2652,7 @@ void initialize_cache(Genotype *genotype)
                                                        *can bind to a cis-reg sequence.*/        
         genotype->Kd[j]=-1.0;
         genotype->locus_length[j]=0;
+        genotype->N_copies[j]=1;
         for(k=0;k<MAX_GENES;k++)        
             genotype->cisreg_cluster[j][k]=NA;
     }    
@@ -1624,7 +2697,12 @@ void initialize_cache(Genotype *genotype)
  */
 static void try_replacement(Genotype *resident, Genotype *mutant, int *flag_replaced, float *selection_coefficient)
 {     
+#if COMMON_RANDOM_NUMBERS
+    /*the mutant has been measured replicate by replicate against the resident*/
+    *selection_coefficient=mutant->avg_fitness_diff/fabs(resident->avg_fitness);
+#else
     *selection_coefficient=(mutant->avg_fitness-resident->avg_fitness)/fabs(resident->avg_fitness);
+#endif
     if(*selection_coefficient>=MIN_SELECTION_COEFFICIENT)
         *flag_replaced=1;
     else          
@@ -1632,7 +2710,11 @@ static void try_replacement(Genotype *resident, Genotype *mutant, int *flag_repl
 }
 
 
-static void replay_mutations(Genotype *resident, Mutation *mut_record, int replay_N_steps)
+/* Replay the first replay_N_steps accepted mutations. Binding sites and motifs are 
+ * scored at every step if score_every_step is 1, otherwise only at the steps
+ * written to networks.txt.
+ */
+static void replay_mutations(Genotype *resident, Mutation *mut_record, int replay_N_steps, int score_every_step)
 {
     int i, output_counter;
     Output_buffer resident_info[OUTPUT_INTERVAL];
@@ -1652,6 +2734,10 @@ static void replay_mutations(Genotype *resident, Mutation *mut_record, int repla
    
     /*remove the old file*/
     remove("networks.txt");  
+#if TOPOLOGY_STREAM
+    remove("topology.bin");
+    N_deltas_since_keyframe=-1;
+#endif
     remove("N_motifs.txt");
     calc_all_binding_sites(resident);
     summarize_binding_sites(resident,0); //make new file and record initial network
@@ -1666,10 +2752,13 @@ static void replay_mutations(Genotype *resident, Mutation *mut_record, int repla
                                                     &(mut_record->kinetic_type),
                                                     &(mut_record->kinetic_diff));
         reproduce_mutate(resident,mut_record); 
-        calc_all_binding_sites(resident);
-        find_motifs(resident); 
-        store_resident_info(resident,NULL,&(resident_info[output_counter]),NA,NA,NA,(float)NA,-1);  
-        output_counter++;
+        if(score_every_step || i%OUTPUT_INTERVAL==0)
+        {
+            calc_all_binding_sites(resident);
+            find_motifs(resident); 
+            store_resident_info(resident,NULL,&(resident_info[output_counter]),NA,NA,NA,(float)NA,-1);  
+            output_counter++;
+        }
         if(i%OUTPUT_INTERVAL==0)
         {
             summarize_binding_sites(resident,i);
@@ -1746,8 +2835,9 @@ static void run_simulation( Genotype *resident,
                                     init_protein,
                                     RS_parallel,                                        
                                     fitness1[i],
-                                    fitness2[i]); 
-            calc_fitness_stats(resident,selection,&(fitness1[0]),&(fitness2[0]),HI_RESOLUTION_RECALC);   
+                                    fitness2[i],
+                                    i); 
+            calc_fitness_stats(resident,selection,&(fitness1[0]),&(fitness2[0]),HI_RESOLUTION_RECALC,NULL,NULL);   
             /*calculate the number of c1-ffls*/
             find_motifs(resident);
             /*save resident status to output buffer*/                  
@@ -1767,7 +2857,7 @@ static void run_simulation( Genotype *resident,
             RngStream_GetState(RS_main,seeds);
             fp=fopen("RngSeeds.txt","a+");
             fprintf(fp,"%lu %lu %lu %lu %lu %lu ",seeds[0],seeds[1],seeds[2],seeds[3],seeds[4],seeds[5]);            
-            for(i=0;i<N_THREADS;i++)
+            for(i=0;i<N_SAVED_PARALLEL_STREAMS;i++)
             {
                 RngStream_GetState(RS_parallel[i],seeds);
                 fprintf(fp,"%lu %lu %lu %lu %lu %lu ",seeds[0],seeds[1],seeds[2],seeds[3],seeds[4],seeds[5]); 
@@ -1775,10 +2865,15 @@ static void run_simulation( Genotype *resident,
             fprintf(fp,"\n");
             fclose(fp);        
 #endif            
+#if INDEXED_MUTATION_LOG
+            if(burn_in->MAX_STEPS%SNAPSHOT_INTERVAL==0)
+                save_genotype_snapshot(resident,burn_in->MAX_STEPS);
+#endif
             /* marks the last step at which all state of the program has been output*/
-            fp=fopen("saving_point.txt","w");
-            fprintf(fp,"%d %d\n",burn_in->MAX_STEPS,N_tot_trials);
-            fclose(fp);
+            write_saving_point(burn_in->MAX_STEPS,N_tot_trials);
+#if BINARY_CHECKPOINT
+            save_checkpoint(resident,mut_record,burn_in->MAX_STEPS,N_tot_trials,MAX_TFBS_NUMBER,RS_main,RS_parallel);
+#endif
         }
     }    
     
@@ -1819,75 +2914,99 @@ static void continue_simulation(Genotype *resident,
                                 RngStream RS_parallel[N_THREADS])
 {
     int i,j,N_tot_mutations;    
-    unsigned long rng_seeds[N_THREADS+1][6];
+    unsigned long rng_seeds[N_SAVED_PARALLEL_STREAMS+1][6];
+    long file_size[N_OUTPUT_FILES];
     char buffer[200]; 
     FILE *fp;
     
-    /*delete the incomplete lines in the output files*/
-    tidy_output_files(evo_summary,mutation_file);
+#if BINARY_CHECKPOINT
+    /*restore everything from checkpoint.bin if it was saved at the saving point*/
+    if(!load_checkpoint(resident, mut_record, replay_N_steps, &N_tot_mutations, RS_main, RS_parallel))
+#endif
+    {
+#if BINARY_OUTPUT
+        /*the text records that mutations are replayed from are not written*/
+        printf("checkpoint.bin is missing or was not saved at step %d, and mutations cannot be replayed under BINARY_OUTPUT! Quit program!\n",replay_N_steps);
+#if MAKE_LOG
+        LOG("checkpoint.bin is missing or was not saved at step %d\n",replay_N_steps);
+#endif
+        exit(-2);
+#endif
+        /*delete the incomplete lines in the output files*/
+        if(read_output_file_sizes(file_size))
+            truncate_output_files(file_size);
+        else
+            tidy_output_files(evo_summary,mutation_file);
     
-    /* set genotype based on previous steps*/   
-    replay_mutations(resident, mut_record, replay_N_steps); 
+        /* set genotype based on previous steps*/   
+        replay_mutations(resident, mut_record, replay_N_steps, 1); 
 
-    /* load random number seeds*/
-    fp=fopen("RngSeeds.txt","r");
-    if(fp!=NULL)
-    {
-        for(i=0;i<replay_N_steps/OUTPUT_INTERVAL;i++)
+        /* load random number seeds*/
+        fp=fopen("RngSeeds.txt","r");
+        if(fp!=NULL)
         {
-            for(j=0;j<N_THREADS;j++)        
+            for(i=0;i<replay_N_steps/OUTPUT_INTERVAL;i++)
             {
-                fscanf(fp,"%lu %lu %lu %lu %lu %lu ", &(rng_seeds[j][0]),
-                                                        &(rng_seeds[j][1]),
-                                                        &(rng_seeds[j][2]),
-                                                        &(rng_seeds[j][3]),
-                                                        &(rng_seeds[j][4]),
-                                                        &(rng_seeds[j][5]));
+                for(j=0;j<N_SAVED_PARALLEL_STREAMS;j++)        
+                {
+                    fscanf(fp,"%lu %lu %lu %lu %lu %lu ", &(rng_seeds[j][0]),
+                                                            &(rng_seeds[j][1]),
+                                                            &(rng_seeds[j][2]),
+                                                            &(rng_seeds[j][3]),
+                                                            &(rng_seeds[j][4]),
+                                                            &(rng_seeds[j][5]));
+                }
+                fscanf(fp,"%lu %lu %lu %lu %lu %lu \n", &(rng_seeds[N_SAVED_PARALLEL_STREAMS][0]),
+                                                        &(rng_seeds[N_SAVED_PARALLEL_STREAMS][1]),
+                                                        &(rng_seeds[N_SAVED_PARALLEL_STREAMS][2]),
+                                                        &(rng_seeds[N_SAVED_PARALLEL_STREAMS][3]),
+                                                        &(rng_seeds[N_SAVED_PARALLEL_STREAMS][4]),
+                                                        &(rng_seeds[N_SAVED_PARALLEL_STREAMS][5]));
             }
-            fscanf(fp,"%lu %lu %lu %lu %lu %lu \n", &(rng_seeds[N_THREADS][0]),
-                                                    &(rng_seeds[N_THREADS][1]),
-                                                    &(rng_seeds[N_THREADS][2]),
-                                                    &(rng_seeds[N_THREADS][3]),
-                                                    &(rng_seeds[N_THREADS][4]),
-                                                    &(rng_seeds[N_THREADS][5]));
         }
-    }
-    else
-    {   
+        else
+        {   
 #if MAKE_LOG
-        LOG("cannot open RngSeeds.txt\n");     
+            LOG("cannot open RngSeeds.txt\n");     
 #endif
-        exit(-2);
-    }
-    fclose(fp);
-    RngStream_SetSeed(RS_main,rng_seeds[0]);
-    for(i=0;i<N_THREADS;i++)
-        RngStream_SetSeed(RS_parallel[i],rng_seeds[i+1]);
+            exit(-2);
+        }
+        fclose(fp);
+        RngStream_SetSeed(RS_main,rng_seeds[0]);
+        for(i=0;i<N_SAVED_PARALLEL_STREAMS;i++)
+            RngStream_SetSeed(RS_parallel[i],rng_seeds[i+1]);
     
-    /* load fitness,N_tot_mutations,N_hit_boundary*/
-    fp=fopen("precise_fitness.txt","r");
-    if(fp!=NULL)
-    {  
-        for(i=0;i<replay_N_steps-1;i++)
-            fgets(buffer,200,fp);
-        fscanf(fp,"%d %d %a %a %a %a %a %a\n",&N_tot_mutations, 
-                                            &(mut_record->N_hit_bound),
-                                            &(resident->avg_fitness),                                            
-                                            &(resident->fitness1),
-                                            &(resident->fitness2),
-                                            &(resident->SE_avg_fitness),
-                                            &(resident->SE_fitness1),
-                                            &(resident->SE_fitness2));
-    }
-    else
-    {   
+        /* load fitness,N_tot_mutations,N_hit_boundary*/
+        fp=fopen("precise_fitness.txt","r");
+        if(fp!=NULL)
+        {  
+            for(i=0;i<replay_N_steps-1;i++)
+                fgets(buffer,200,fp);
+            fscanf(fp,"%d %d %a %a %a %a %a %a\n",&N_tot_mutations, 
+                                                &(mut_record->N_hit_bound),
+                                                &(resident->avg_fitness),                                            
+                                                &(resident->fitness1),
+                                                &(resident->fitness2),
+                                                &(resident->SE_avg_fitness),
+                                                &(resident->SE_fitness1),
+                                                &(resident->SE_fitness2));
+#if STRATIFIED_BURN_IN || ANTITHETIC_REPLICATES
+            fscanf(fp,"%a",&(resident->variance_reduction));
+#endif
+#if ADAPTIVE_HI_RESOLUTION
+            fscanf(fp,"%d",&(resident->N_fitness_measurements));
+#endif
+        }
+        else
+        {   
 #if MAKE_LOG
-        LOG("cannot open precise_fitness.txt\n");       
+            LOG("cannot open precise_fitness.txt\n");       
 #endif
-        exit(-2);
-    }        
-    fclose(fp);
-    
+            exit(-2);
+        }        
+        fclose(fp);
+    }
+
     /*continue running simulation*/
     run_simulation( resident, 
                     mutant,
@@ -1902,11 +3021,17 @@ static void continue_simulation(Genotype *resident,
                     RS_parallel);    
 }
 
+/*
+ *If the fitness of a reference genotype, measured with the same rng substreams as 
+ *the first batch of f1 and f2, is given, also calculate the mean and SE of the paired differences
+ */
 static void calc_fitness_stats( Genotype *genotype,
                                 Selection *selection,
                                 float (*f1)[N_REPLICATES],
                                 float (*f2)[N_REPLICATES],                
-                                int N_recalc_fitness)
+                                int N_recalc_fitness,
+                                float *ref_f1,
+                                float *ref_f2)
 {
     float avg_f1=0.0;
     float avg_f2=0.0;       
@@ -1914,6 +3039,10 @@ static void calc_fitness_stats( Genotype *genotype,
     float sum_sq_diff_f2=0.0;   
     float sum_sq_diff_mean_f=0.0;
     float diff_f1,diff_f2,sq_SE_f1,sq_SE_f2;    
+#if STRATIFIED_BURN_IN || ANTITHETIC_REPLICATES
+    float weighted_f[N_REPLICATES];
+    float sq_SE_avg_f=0.0;
+#endif
     int counter=0;
     int i,j;
 
@@ -1950,7 +3079,150 @@ static void calc_fitness_stats( Genotype *genotype,
     genotype->SE_fitness2=sqrt(sq_SE_f2);     
     genotype->avg_fitness=selection->env1_weight*avg_f1+selection->env2_weight*avg_f2;
     genotype->SE_avg_fitness=sqrt(sum_sq_diff_mean_f/(N_recalc_fitness*N_REPLICATES-1)/(N_recalc_fitness*N_REPLICATES)); 
+    genotype->N_fitness_measurements=counter;
+#if STRATIFIED_BURN_IN || ANTITHETIC_REPLICATES
+    /*replicates are not independent, so the SEs above overestimate the error. 
+     *Calculate the SE of each batch and pool the batches*/
+    sq_SE_f1=0.0;
+    sq_SE_f2=0.0;
+    for(i=0;i<N_recalc_fitness;i++)
+    {
+        for(j=0;j<N_REPLICATES;j++)
+            weighted_f[j]=selection->env1_weight*f1[i][j]+selection->env2_weight*f2[i][j];
+        sq_SE_f1+=calc_sq_SE_of_batch(f1[i]);
+        sq_SE_f2+=calc_sq_SE_of_batch(f2[i]);
+        sq_SE_avg_f+=calc_sq_SE_of_batch(weighted_f);
+    }
+    sq_SE_f1=sq_SE_f1/(N_recalc_fitness*N_recalc_fitness);
+    sq_SE_f2=sq_SE_f2/(N_recalc_fitness*N_recalc_fitness);
+    sq_SE_avg_f=sq_SE_avg_f/(N_recalc_fitness*N_recalc_fitness);
+    genotype->variance_reduction=(sq_SE_avg_f>0.0)?pow(genotype->SE_avg_fitness,2.0)/sq_SE_avg_f:1.0;
+    genotype->SE_fitness1=sqrt(sq_SE_f1);
+    genotype->SE_fitness2=sqrt(sq_SE_f2);
+    genotype->SE_avg_fitness=sqrt(sq_SE_avg_f);
+#endif
+    
+    /*paired comparison with the reference*/
+    if(ref_f1!=NULL && ref_f2!=NULL)
+    {
+        float diff[N_REPLICATES];
+        float avg_diff=0.0;
+        for(j=0;j<N_REPLICATES;j++)
+        {
+            diff[j]=selection->env1_weight*(f1[0][j]-ref_f1[j])+selection->env2_weight*(f2[0][j]-ref_f2[j]);
+            avg_diff+=diff[j];
+        }
+        avg_diff=avg_diff/N_REPLICATES;
+        genotype->avg_fitness_diff=avg_diff;
+#if STRATIFIED_BURN_IN || ANTITHETIC_REPLICATES
+        genotype->SE_avg_fitness_diff=sqrt(calc_sq_SE_of_batch(diff));
+#else
+        float sum_sq_diff_diff=0.0;
+        for(j=0;j<N_REPLICATES;j++)
+            sum_sq_diff_diff+=pow(diff[j]-avg_diff,2.0);
+        genotype->SE_avg_fitness_diff=sqrt(sum_sq_diff_diff/(N_REPLICATES-1)/N_REPLICATES);
+#endif
+    }
+}
+
+#if COMMON_RANDOM_NUMBERS
+/*
+ *calc_avg_fitness draws the replicates of a batch from consecutive substreams, counted 
+ *from the current substream of a thread's rng stream. Move the streams past all the 
+ *substreams that the HI_RESOLUTION_RECALC batches of an evolutionary step can use.
+ */
+static void skip_used_substreams(RngStream RS_parallel[N_THREADS])
+{
+    int j;
+#if THREAD_INVARIANT_RNG
+    for(j=0;j<2*HI_RESOLUTION_RECALC*N_REPLICATES;j++)
+        RngStream_ResetNextSubstream(RS_parallel[0]);
+#else
+    int i;
+    for(i=0;i<N_THREADS;i++)
+    {
+        for(j=0;j<2*HI_RESOLUTION_RECALC*N_REPLICATES/N_THREADS;j++)
+            RngStream_ResetNextSubstream(RS_parallel[i]);
+    }
+#endif
 }
+#endif
+
+#if MEAN_FIELD_PRESCREEN
+/*
+ *Fitness predicted by the mean-field model, weighted over the two environments. 
+ *Burn-in lasts for its average duration.
+ */
+static float calc_mean_field_avg_fitness(Genotype *genotype, Selection *selection, int init_mRNA[MAX_GENES], float init_protein_number[MAX_PROTEINS])
+{
+    int i,j;
+    int mRNA[MAX_GENES];
+    float protein[MAX_GENES];
+    float f1,f2;
+    
+    /*set initial mRNA and protein numbers as in calc_avg_fitness*/
+    for(j=N_SIGNAL_TF;j<genotype->ngenes;j++)
+        mRNA[j]=init_mRNA[j];
+    for(j=N_SIGNAL_TF;j<genotype->nproteins;j++)
+    {
+        for(i=0;i<genotype->protein_pool[j][0][0];i++)
+            protein[genotype->protein_pool[j][1][i]]=(float)init_protein_number[j]/genotype->protein_pool[j][0][0];
+    }
+    f1=calc_mean_field_fitness(genotype, &(selection->env1), selection->env1.avg_duration_of_burn_in_growth_rate, mRNA, protein);
+    f2=calc_mean_field_fitness(genotype, &(selection->env2), selection->env2.avg_duration_of_burn_in_growth_rate, mRNA, protein);
+    return selection->env1_weight*f1+selection->env2_weight*f2;
+}
+#endif
+
+#if STRATIFIED_BURN_IN
+/*
+ *The duration of burn-in follows an exponential distribution truncated at max_duration_of_burn_in_growth_rate.
+ *Replicate k draws from the kth of N_REPLICATES equally probable strata of the distribution by inverting its CDF.
+ */
+static float draw_stratified_burn_in_time(Environment *env, int k, RngStream RS)
+{
+    float p_max,u;
+    p_max=1.0-exp(-env->max_duration_of_burn_in_growth_rate/env->avg_duration_of_burn_in_growth_rate);
+    u=((float)k+RngStream_RandU01(RS))/N_REPLICATES;
+    return -env->avg_duration_of_burn_in_growth_rate*log(1.0-u*p_max);
+}
+#endif
+
+#if STRATIFIED_BURN_IN || ANTITHETIC_REPLICATES
+/*
+ *Squared SE of the mean of a batch of N_REPLICATES replicates. Antithetic pairs are averaged 
+ *first. Under STRATIFIED_BURN_IN, there is one replicate (or pair) per stratum, so adjacent 
+ *strata are collapsed in twos and the variance of each collapsed stratum is estimated from the 
+ *difference between its two members.
+ */
+static float calc_sq_SE_of_batch(float *y)
+{
+    float z[N_REPLICATES];
+    float sum_sq_diff=0.0;
+    int M=N_REPLICATES/(ANTITHETIC_REPLICATES+1);
+    int m;
+    
+    for(m=0;m<M;m++)
+#if ANTITHETIC_REPLICATES
+        z[m]=0.5*(y[2*m]+y[2*m+1]);
+#else
+        z[m]=y[m];
+#endif
+#if STRATIFIED_BURN_IN
+    for(m=0;m<M;m+=2)
+        sum_sq_diff+=pow(z[m]-z[m+1],2.0);
+    return sum_sq_diff/(M*M);
+#else
+    float avg_z=0.0;
+    for(m=0;m<M;m++)
+        avg_z+=z[m];
+    avg_z=avg_z/M;
+    for(m=0;m<M;m++)
+        sum_sq_diff+=pow(z[m]-avg_z,2.0);
+    return sum_sq_diff/(M-1)/M;
+#endif
+}
+#endif
 
 static int evolve_N_steps(  Genotype *resident, 
                             Genotype *mutant,
@@ -1971,12 +3243,31 @@ static int evolve_N_steps(  Genotype *resident,
     int N_trials;
     float fitness1[HI_RESOLUTION_RECALC][N_REPLICATES],fitness2[HI_RESOLUTION_RECALC][N_REPLICATES];
     float selection_coefficient; 
+    float *paired_fitness1=NULL, *paired_fitness2=NULL;
     FILE *fp;
+#if MEAN_FIELD_PRESCREEN
+    float mean_field_resident,mean_field_mutant;
+    int flag_screened_out;
+#endif
+#if COMMON_RANDOM_NUMBERS
+    float resident_fitness1[N_REPLICATES],resident_fitness2[N_REPLICATES];
+    paired_fitness1=resident_fitness1;
+    paired_fitness2=resident_fitness2;
+#endif
+#if ASYNC_OUTPUT
+    int flag_saving_point;
+    start_output_writer();
+#endif
 #if OUTPUT_MUTANT_DETAILS
     Output_buffer *mutant_info;  
     int mutant_counter=0;
+#if ASYNC_OUTPUT
+    int current_mutant_info_size=output_jobs[job_being_filled].mutant_info_size;
+    mutant_info=output_jobs[job_being_filled].mutant_info;
+#else
     int current_mutant_info_size=OUTPUT_INTERVAL*50;
     mutant_info=(Output_buffer *)malloc(current_mutant_info_size*sizeof(Output_buffer));
+#endif
 #endif
  
     for(i=(*init_step);i<=selection->MAX_STEPS;i++)
@@ -1984,6 +3275,15 @@ static int evolve_N_steps(  Genotype *resident,
         flag_replaced=0;      
         N_trials=0;
         
+#if COMMON_RANDOM_NUMBERS
+        /*move to fresh substreams, and measure the resident with the substreams that mutants at this step will use*/
+        skip_used_substreams(RS_parallel);
+        calc_avg_fitness(resident, selection, init_mRNA, init_protein, RS_parallel, resident_fitness1, resident_fitness2, 0);
+#endif
+#if MEAN_FIELD_PRESCREEN
+        mean_field_resident=calc_mean_field_avg_fitness(resident, selection, init_mRNA, init_protein);
+#endif
+        
         /*try mutations until one replaces the current genotype*/
         while(!flag_replaced) 
         {	
@@ -1991,6 +3291,9 @@ static int evolve_N_steps(  Genotype *resident,
             (*N_tot_trials)++;
             if(N_trials>MAX_TRIALS) /*Tried too many mutation in one step.*/
             {
+#if ASYNC_OUTPUT
+                stop_output_writer();
+#endif
 #if OUTPUT_MUTANT_DETAILS                
                 output_mutant_info(mutant_info,mutant_counter);
 #endif
@@ -2010,20 +3313,54 @@ static int evolve_N_steps(  Genotype *resident,
             calc_all_binding_sites(mutant);           
             MAX_TFBS_NUMBER=mutant->N_allocated_elements;
 
-            /*calculate the fitness of the mutant at low resolution*/
-            calc_avg_fitness(mutant, selection, init_mRNA, init_protein, RS_parallel, fitness1[0], fitness2[0]);
-            calc_fitness_stats(mutant, selection, &(fitness1[0]), &(fitness2[0]), 1); // calc fitness at low resolution
+#if MEAN_FIELD_PRESCREEN
+            /*screen out mutants that are predicted to be much less fit than the resident*/
+            mean_field_mutant=calc_mean_field_avg_fitness(mutant, selection, init_mRNA, init_protein);
+            flag_screened_out=(mean_field_mutant<mean_field_resident-MEAN_FIELD_MARGIN*fabs(mean_field_resident));
+#endif
+#if MEAN_FIELD_PRESCREEN==1
+            if(flag_screened_out) //mark the mutant as not simulated
+            {
+                mutant->avg_fitness=mean_field_mutant;
+                mutant->fitness1=mean_field_mutant;
+                mutant->fitness2=mean_field_mutant;
+                mutant->SE_avg_fitness=-1.0;
+                mutant->SE_fitness1=-1.0;
+                mutant->SE_fitness2=-1.0;
+                mutant->avg_fitness_diff=mean_field_mutant-mean_field_resident;
+                mutant->SE_avg_fitness_diff=-1.0;
+                mutant->variance_reduction=1.0;
+            }
+            else
+#endif
+            {
+                /*calculate the fitness of the mutant at low resolution*/
+                calc_avg_fitness(mutant, selection, init_mRNA, init_protein, RS_parallel, fitness1[0], fitness2[0], 0);
+                calc_fitness_stats(mutant, selection, &(fitness1[0]), &(fitness2[0]), 1, paired_fitness1, paired_fitness2); // calc fitness at low resolution
+            }
 
 #if OUTPUT_MUTANT_DETAILS
             if(mutant_counter>=current_mutant_info_size)
             {
                 current_mutant_info_size+=OUTPUT_INTERVAL*100;
                 mutant_info=(Output_buffer *)realloc(mutant_info,current_mutant_info_size*sizeof(Output_buffer));
+#if ASYNC_OUTPUT
+                output_jobs[job_being_filled].mutant_info=mutant_info;
+                output_jobs[job_being_filled].mutant_info_size=current_mutant_info_size;
+#endif
             }
             store_mutant_info(mutant,mut_record,&(mutant_info[mutant_counter]),i,*N_tot_trials);      
+#if MEAN_FIELD_PRESCREEN
+            mutant_info[mutant_counter].mean_field_f=mean_field_mutant;
+            mutant_info[mutant_counter].mean_field_resident_f=mean_field_resident;
+            mutant_info[mutant_counter].screened_out=flag_screened_out;
+#endif
             mutant_counter++;
 #endif
             /*Can the mutant replace the current genotype?*/
+#if MEAN_FIELD_PRESCREEN==1
+            if(!flag_screened_out)
+#endif
             try_replacement(resident, mutant, &flag_replaced, &selection_coefficient);
         }
         
@@ -2037,9 +3374,22 @@ static int evolve_N_steps(  Genotype *resident,
          * which is done in run_simulation, outside the current function*/
         if(!(i==selection->MAX_STEPS && flag_burn_in)) 
         {
+#if ADAPTIVE_HI_RESOLUTION
+            /*add batches until the SE is small enough. The first batch, which got the mutant accepted, 
+             *tends to overestimate fitness, so at least one more batch is always calculated*/
+            j=1;
+            do
+            {
+                calc_avg_fitness(resident, selection, init_mRNA, init_protein, RS_parallel, fitness1[j],fitness2[j],j);
+                j++;
+                calc_fitness_stats(resident, selection, &(fitness1[0]), &(fitness2[0]), j, NULL, NULL);
+            }
+            while(j<HI_RESOLUTION_RECALC && resident->SE_avg_fitness>TARGET_RELATIVE_SE*fabs(resident->avg_fitness));
+#else
             for(j=1;j<HI_RESOLUTION_RECALC;j++)  
-                calc_avg_fitness(resident, selection, init_mRNA, init_protein, RS_parallel, fitness1[j],fitness2[j]);              
-            calc_fitness_stats(resident, selection, &(fitness1[0]), &(fitness2[0]), HI_RESOLUTION_RECALC);   
+                calc_avg_fitness(resident, selection, init_mRNA, init_protein, RS_parallel, fitness1[j],fitness2[j],j);              
+            calc_fitness_stats(resident, selection, &(fitness1[0]), &(fitness2[0]), HI_RESOLUTION_RECALC, NULL, NULL);   
+#endif
         }  
         
         /*calculate the number of c1-ffls*/
@@ -2052,6 +3402,20 @@ static int evolve_N_steps(  Genotype *resident,
         /*output network topology every OUTPUT_INTERVAL steps*/
         if(i%OUTPUT_INTERVAL==0 && i!=0)
         {  
+#if ASYNC_OUTPUT
+            /*the writer thread also outputs rng seeds and the saving point*/
+            flag_saving_point=!(i==selection->MAX_STEPS && flag_burn_in);
+#if OUTPUT_MUTANT_DETAILS
+            submit_output_job(resident,mut_record,resident_info,output_counter,mutant_counter,i,*N_tot_trials,flag_saving_point,RS_main,RS_parallel);
+            mutant_info=output_jobs[job_being_filled].mutant_info;
+            current_mutant_info_size=output_jobs[job_being_filled].mutant_info_size;
+            mutant_counter=0;
+#else
+            submit_output_job(resident,mut_record,resident_info,output_counter,0,i,*N_tot_trials,flag_saving_point,RS_main,RS_parallel);
+#endif
+            if(flag_saving_point)
+                output_counter=0;
+#else
             summarize_binding_sites(resident,i);
 #if OUTPUT_MUTANT_DETAILS 
             output_mutant_info(mutant_info,mutant_counter);
@@ -2062,8 +3426,9 @@ static int evolve_N_steps(  Genotype *resident,
                 output_resident_info(resident_info,output_counter,1); //magic number 1 means to output everything
                 output_counter=0;
             }
+#endif
         }
-           
+#if !ASYNC_OUTPUT
         /* output rng seeds*/
 #if OUTPUT_RNG_SEEDS
         unsigned long seeds[6];
@@ -2072,7 +3437,7 @@ static int evolve_N_steps(  Genotype *resident,
             RngStream_GetState(RS_main,seeds);
             fp=fopen("RngSeeds.txt","a+");
             fprintf(fp,"%lu %lu %lu %lu %lu %lu ",seeds[0],seeds[1],seeds[2],seeds[3],seeds[4],seeds[5]); 
-            for(j=0;j<N_THREADS;j++)
+            for(j=0;j<N_SAVED_PARALLEL_STREAMS;j++)
             {
                 RngStream_GetState(RS_parallel[j],seeds);
                 fprintf(fp,"%lu %lu %lu %lu %lu %lu ",seeds[0],seeds[1],seeds[2],seeds[3],seeds[4],seeds[5]);                
@@ -2087,15 +3452,25 @@ static int evolve_N_steps(  Genotype *resident,
         {
             if(i%OUTPUT_INTERVAL==0)
             {
-                fp=fopen("saving_point.txt","w");
-                fprintf(fp,"%d %d\n",i,*N_tot_trials);
-                fflush(fp);
-                fclose(fp);
+#if INDEXED_MUTATION_LOG
+                if(i%SNAPSHOT_INTERVAL==0)
+                    save_genotype_snapshot(resident,i);
+#endif
+                write_saving_point(i,*N_tot_trials);
+#if BINARY_CHECKPOINT
+                save_checkpoint(resident,mut_record,i,*N_tot_trials,MAX_TFBS_NUMBER,RS_main,RS_parallel);
+#endif
             }    
         }
+#endif
     } 
     *init_step=i;
+#if ASYNC_OUTPUT
+    /*everything must be on disk before run_simulation outputs more*/
+    stop_output_writer();
+#else
     free(mutant_info);
+#endif
     return 0;
 }
 
@@ -2119,9 +3494,13 @@ static void print_motifs(Genotype *genotype)
 
 static void summarize_binding_sites(Genotype *genotype, int step_i)
 {
-    FILE *OUTPUT1;
     int i,j;
     int table[MAX_GENES][MAX_GENES];
+#if TOPOLOGY_STREAM
+    Topology topology;
+#else
+    FILE *OUTPUT1;
+#endif
         
     for(i=0;i<genotype->ngenes;i++)
     {
@@ -2162,6 +3541,21 @@ static void summarize_binding_sites(Genotype *genotype, int step_i)
         }    
     }
     
+#if TOPOLOGY_STREAM
+    memset(&topology,0,sizeof(Topology));
+    topology.ngenes=genotype->ngenes;
+    topology.nproteins=genotype->nproteins;
+    for(i=0;i<genotype->nproteins-1;i++)
+        topology.protein_identity[i]=genotype->protein_identity[i];
+    for(i=N_SIGNAL_TF;i<genotype->ngenes;i++)
+    {
+        topology.which_protein[i]=genotype->which_protein[i];
+        topology.AND_gate_capable[i]=(genotype->min_N_activator_to_transc[i]!=1);
+        for(j=0;j<genotype->nproteins-1;j++)
+            topology.N_sites[i][j]=table[i][j];
+    }
+    append_topology(&topology,step_i);
+#else
     /*Output all binding sites*/ 
     OUTPUT1=fopen("networks.txt","a+");
     fprintf(OUTPUT1,"step %d\n",step_i);
@@ -2210,7 +3604,198 @@ static void summarize_binding_sites(Genotype *genotype, int step_i)
     fprintf(OUTPUT1,"\n"); 
     fprintf(OUTPUT1,"\n"); 
     fclose(OUTPUT1);
+#endif
+}
+
+#if TOPOLOGY_STREAM
+/*write a network as the bytes that changed from the last network, or in whole every TOPOLOGY_KEYFRAME_INTERVAL networks*/
+static void append_topology(Topology *topology, int step)
+{
+    int header[3]={MAX_GENES,MAX_PROTEINS,N_SIGNAL_TF};
+    unsigned short N_changes,offset;
+    size_t i;
+    unsigned char *old_bytes=(unsigned char *)&last_topology,*new_bytes=(unsigned char *)topology;
+    char type;
+    FILE *fp;
+    
+    if(N_deltas_since_keyframe==-1)
+        read_last_topology();
+    fp=fopen("topology.bin","ab");
+    if(fp==NULL)
+    {
+        printf("Cannot write topology.bin! Quit program!\n");
+#if MAKE_LOG
+        LOG("cannot write topology.bin\n");
+#endif
+        exit(-2);
+    }
+    if(ftell(fp)==0)
+    {
+        fwrite("NSTOPOL2",1,8,fp);
+        fwrite(header,sizeof(int),3,fp);
+        N_deltas_since_keyframe=-1;
+    }
+    fwrite(&step,sizeof(int),1,fp);
+    if(N_deltas_since_keyframe==-1 || N_deltas_since_keyframe==TOPOLOGY_KEYFRAME_INTERVAL-1)
+    {
+        type='K';
+        fwrite(&type,1,1,fp);
+        fwrite(topology,sizeof(Topology),1,fp);
+        N_deltas_since_keyframe=0;
+    }
+    else
+    {
+        type='D';
+        fwrite(&type,1,1,fp);
+        N_changes=0;
+        for(i=0;i<sizeof(Topology);i++)
+            N_changes+=(old_bytes[i]!=new_bytes[i]);
+        fwrite(&N_changes,sizeof(unsigned short),1,fp);
+        for(i=0;i<sizeof(Topology);i++)
+        {
+            if(old_bytes[i]!=new_bytes[i])
+            {
+                offset=i;
+                fwrite(&offset,sizeof(unsigned short),1,fp);
+                fwrite(&new_bytes[i],1,1,fp);
+            }
+        }
+        N_deltas_since_keyframe++;
+    }
+    fclose(fp);
+    memcpy(&last_topology,topology,sizeof(Topology));
+}
+
+/*decode topology.bin up to its last network, after the file was truncated to a saving point*/
+static void read_last_topology(void)
+{
+    int step,header[3];
+    char magic[8];
+    FILE *fp;
+    
+    fp=fopen("topology.bin","rb");
+    if(fp==NULL)
+        return;
+    if(fread(magic,1,8,fp)==8 && 
+        memcmp(magic,"NSTOPOL2",8)==0 && 
+        fread(header,sizeof(int),3,fp)==3 && 
+        header[0]==MAX_GENES && 
+        header[1]==MAX_PROTEINS && 
+        header[2]==N_SIGNAL_TF)
+    {
+        while(1)
+        {
+            switch(read_topology(fp,&last_topology,&step))
+            {
+                case 'K':
+                    N_deltas_since_keyframe=0;
+                    continue;
+                case 'D':
+                    N_deltas_since_keyframe++;
+                    continue;
+            }
+            break;
+        }
+    }
+    fclose(fp);
+}
+
+/*apply the next network in topology.bin to topology. Returns its type, or 0 at the end of the file*/
+static int read_topology(FILE *fp, Topology *topology, int *step)
+{
+    int i;
+    char type;
+    unsigned short N_changes,offset;
+    unsigned char value;
+    
+    if(fread(step,sizeof(int),1,fp)!=1 || fread(&type,1,1,fp)!=1)
+        return 0;
+    if(type=='K')
+        return (fread(topology,sizeof(Topology),1,fp)==1)?'K':0;
+    if(fread(&N_changes,sizeof(unsigned short),1,fp)!=1)
+        return 0;
+    for(i=0;i<N_changes;i++)
+    {
+        if(fread(&offset,sizeof(unsigned short),1,fp)!=1 || fread(&value,1,1,fp)!=1 || offset>=sizeof(Topology))
+            return 0;
+        ((unsigned char *)topology)[offset]=value;
+    }
+    return 'D';
+}
+#endif
+
+#if INCREMENTAL_MOTIF_COUNT && !PERTURB && !SAMPLE_PARAMETERS
+/*FNV-1a*/
+static void add_to_fingerprint(unsigned long long *fingerprint, const void *data, size_t size)
+{
+    size_t i;
+    for(i=0;i<size;i++)
+    {
+        *fingerprint^=((const unsigned char *)data)[i];
+        *fingerprint*=1099511628211ULL;
+    }
+}
+
+/*Fingerprint of what find_motifs reads when counting motifs at an effector cluster: the size of the cluster, 
+ *the activator binding sites on the effector gene that pass the cut-offs, and for each non-signal activator, 
+ *its TF family and, for each gene encoding it, the decay rate and the binding sites of the signal and the activators that pass the cut-offs.
+ *Sites are reduced to which cut-offs they pass, and gene ids are left out, so that most mutations, 
+ *and duplications and deletions of genes outside the motifs, leave the fingerprint unchanged*/
+static unsigned long long fingerprint_effector_cluster(Genotype *genotype, int effector_gene_id, int cluster_size)
+{
+    unsigned long long fingerprint=14695981039346656037ULL;
+    int i,j,k,gene_id;
+    int is_activator[MAX_PROTEINS];
+    int site[4];
+    AllTFBindingSites *binding_site;
+    
+    add_to_fingerprint(&fingerprint,&cluster_size,sizeof(int));
+    for(i=0;i<MAX_PROTEINS;i++)
+        is_activator[i]=0;
+    for(i=0;i<genotype->binding_sites_num[effector_gene_id];i++)
+    {
+        binding_site=&(genotype->all_binding_sites[effector_gene_id][i]);
+        if(genotype->protein_identity[binding_site->tf_id]!=ACTIVATOR)
+            continue;
+        site[0]=binding_site->tf_id;
+        site[1]=binding_site->BS_pos;
+        site[2]=(binding_site->mis_match<=CUT_OFF_MISMATCH_SIG2EFFECTOR)+2*(binding_site->mis_match<=CUT_OFF_MISMATCH_TF2EFFECTOR);
+        site[3]=(COUNT_NEAR_AND && binding_site->mis_match<CONSENSUS_SEQ_LEN-NMIN);
+        if(site[2]!=0)
+        {
+            add_to_fingerprint(&fingerprint,site,sizeof(site));
+            is_activator[binding_site->tf_id]=1;
+        }
+    }
+    for(i=N_SIGNAL_TF;i<genotype->nproteins;i++)
+    {
+        if(!is_activator[i])
+            continue;
+        add_to_fingerprint(&fingerprint,&i,sizeof(int));
+        add_to_fingerprint(&fingerprint,&(genotype->which_TF_family[i]),sizeof(int));
+        add_to_fingerprint(&fingerprint,&(genotype->protein_pool[i][0][0]),sizeof(int));
+        for(j=0;j<genotype->protein_pool[i][0][0];j++)
+        {
+            gene_id=genotype->protein_pool[i][1][j];
+            add_to_fingerprint(&fingerprint,&(genotype->protein_decay_rate[gene_id]),sizeof(float));
+            for(k=0;k<genotype->binding_sites_num[gene_id];k++)
+            {
+                binding_site=&(genotype->all_binding_sites[gene_id][k]);
+                if(binding_site->tf_id!=N_SIGNAL_TF-1 && !is_activator[binding_site->tf_id])
+                    continue;
+                site[0]=binding_site->tf_id;
+                site[1]=(binding_site->mis_match<=CUT_OFF_MISMATCH_SIGNAL2TF)+2*(binding_site->mis_match<=CUT_OFF_MISMATCH_TF2TF);
+                if(site[1]!=0)
+                    add_to_fingerprint(&fingerprint,site,2*sizeof(int));
+            }
+            /*mark the end of the sites of a gene*/
+            site[0]=-1;
+            add_to_fingerprint(&fingerprint,site,sizeof(int));
+        }
+    }
+    return fingerprint;
 }
+#endif
 
 /*find subtypes of C1-FFLs, FFL-in-diamond, and diamonds*/
 static void find_motifs(Genotype *genotype)
@@ -2224,6 +3809,10 @@ static void find_motifs(Genotype *genotype)
     int copies_reg_by_env[MAX_GENES],copies_not_reg_by_env[MAX_GENES],N_copies_reg_by_env,N_copies_not_reg_by_env;
     int hindrance[MAX_PROTEINS][MAX_PROTEINS];    
     int strong_BS_pos[MAX_PROTEINS][2][50];    // 50 slots should be enough to store TFBSs positions on a gene
+#if INCREMENTAL_MOTIF_COUNT && !PERTURB && !SAMPLE_PARAMETERS
+    unsigned long long fingerprint;
+    MotifCache *cache;
+#endif
     
     /*reset records*/
     for(i=0;i<36;i++)
@@ -2265,6 +3854,29 @@ static void find_motifs(Genotype *genotype)
                 cluster_size=0;
                 while(genotype->cisreg_cluster[i][cluster_size]!=NA)
                     cluster_size++;
+#if INCREMENTAL_MOTIF_COUNT && !PERTURB && !SAMPLE_PARAMETERS
+                /*reuse the motifs of the cluster if nothing they depend on has changed*/
+                fingerprint=fingerprint_effector_cluster(genotype, effector_gene_id, cluster_size);
+                cache=&(motif_cache[fingerprint%MAX_GENES]);
+                if(cache->valid && cache->fingerprint==fingerprint)
+                {
+                    for(j=0;j<36;j++)
+                        genotype->N_motifs[j]+=cache->N_motifs[j];
+#if COUNT_NEAR_AND
+                    for(j=0;j<12;j++)
+                        genotype->N_near_AND_gated_motifs[j]+=cache->N_near_AND_gated_motifs[j];
+#endif
+                    i++;
+                    continue;
+                }
+                /*the counts of the cluster are what it adds to the records*/
+                for(j=0;j<36;j++)
+                    cache->N_motifs[j]=genotype->N_motifs[j];
+#if COUNT_NEAR_AND
+                for(j=0;j<12;j++)
+                    cache->N_near_AND_gated_motifs[j]=genotype->N_near_AND_gated_motifs[j];
+#endif
+#endif
 #if COUNT_NEAR_AND
                 /*reset table for recording strength of interaction*/
                 for(j=0;j<MAX_PROTEINS;j++)
@@ -2351,6 +3963,16 @@ static void find_motifs(Genotype *genotype)
                                                     slow_TF_gene_id);   
                     }
                 }  
+#endif
+#if INCREMENTAL_MOTIF_COUNT && !PERTURB && !SAMPLE_PARAMETERS
+                for(j=0;j<36;j++)
+                    cache->N_motifs[j]=genotype->N_motifs[j]-cache->N_motifs[j];
+#if COUNT_NEAR_AND
+                for(j=0;j<12;j++)
+                    cache->N_near_AND_gated_motifs[j]=genotype->N_near_AND_gated_motifs[j]-cache->N_near_AND_gated_motifs[j];
+#endif
+                cache->fingerprint=fingerprint;
+                cache->valid=1;
 #endif
             }
             i++;
@@ -3041,6 +4663,7 @@ static void remove_binding_sites(Genotype *genotype, int gene_id)
 }
 #endif //end of PERTURB mode
 
+/*Used to continue a simulation whose saving_point.txt does not record the sizes of the output files*/
 static void tidy_output_files(char *file_genotype_summary, char *file_mutations)
 {
     int i,replay_N_steps,N_tot_mutations;
@@ -3144,44 +4767,629 @@ static void tidy_output_files(char *file_genotype_summary, char *file_mutations)
     rename("temp","precise_fitness.txt");
 }
 
-void print_mutatable_parameters(Genotype *genotype,int init_or_end)
+/*output files that are appended to during evolution*/
+static void list_output_files(char *files[N_OUTPUT_FILES])
+{
+    files[0]=evo_summary;
+    files[1]=mutation_file;
+    files[2]="precise_fitness.txt";
+    files[3]="N_motifs.txt";
+    files[4]="N_near_AND_gated_motifs.txt";
+    files[5]="networks.txt";
+    files[6]="RngSeeds.txt";
+    files[7]="all_mutations.txt";
+    files[8]="fitness_all_mutants.txt";
+    files[9]="residents.bin";
+    files[10]="mutants.bin";
+    files[11]="all_mutations.txt.gz";
+    files[12]="fitness_all_mutants.txt.gz";
+    files[13]="mutant_log_index.txt";
+    files[14]="mutations.bin";
+    files[15]="genotypes.bin";
+    files[16]="topology.bin";
+}
+
+/*size in bytes of each output file, -1 if a file does not exist*/
+static void measure_output_files(long file_size[N_OUTPUT_FILES])
 {
     int i;
-    FILE *fp;    
-    if(init_or_end==1)
-        fp=fopen("end_mutatable_parameters.txt","w");
-    else
-        fp=fopen("init_mutatable_parameters.txt","w");
-    
-    for(i=0;i<genotype->ngenes;i++)
+    char *files[N_OUTPUT_FILES];
+    FILE *fp;
+    list_output_files(files);
+    for(i=0;i<N_OUTPUT_FILES;i++)
     {
-        fprintf(fp,"%f %f %f %f %d ",genotype->active_to_intermediate_rate[i],
-                                    genotype->mRNA_decay_rate[i],
-                                    genotype->translation_rate[i],
-                                    genotype->protein_decay_rate[i],
-                                    genotype->locus_length[i]);
-        if(genotype->protein_identity[genotype->which_protein[i]]!=-1) //is a tf gene
-            fprintf(fp,"%f\n",log10(genotype->Kd[genotype->which_protein[i]]));
-        else
-             fprintf(fp,"na\n");
+        file_size[i]=-1;
+        fp=fopen(files[i],"r");
+        if(fp!=NULL)
+        {
+            fseek(fp,0,SEEK_END);
+            file_size[i]=ftell(fp);
+            fclose(fp);
+        }
     }
-    fclose(fp);
 }
 
-static void store_resident_info(Genotype *resident, 
-                                Mutation *mut_record, 
-                                Output_buffer *resident_info, 
-                                int evo_step, 
-                                int N_mutations_at_current_step, 
-                                int N_tot_mutations, 
-                                float selection_coefficient, 
-                                int flag)
-{  
+/*discard whatever was output after a saving point*/
+static void truncate_output_files(long file_size[N_OUTPUT_FILES])
+{
     int i;
- 
-   /*always store network motifs*/
-    for(i=0;i<36;i++)
-        resident_info->n_motifs[i]=resident->N_motifs[i];
+    char *files[N_OUTPUT_FILES];
+    list_output_files(files);
+    for(i=0;i<N_OUTPUT_FILES;i++)
+    {
+        if(file_size[i]!=-1)
+            truncate(files[i],(off_t)file_size[i]);
+    }
+}
+
+/*saving_point.txt stores the step and the number of mutations tried in the first line, 
+ *and the sizes of the output files in the second line. It is written to saving_point.tmp, 
+ *then renamed, so an interruption leaves either the old or the new saving point*/
+static void write_saving_point(int step, int N_tot_trials)
+{
+    int i;
+    long file_size[N_OUTPUT_FILES];
+    FILE *fp;
+    measure_output_files(file_size);
+    fp=fopen("saving_point.tmp","w");
+    if(fp==NULL)
+    {
+        printf("Cannot write saving_point.tmp! Quit program!\n");
+#if MAKE_LOG
+        LOG("cannot write saving_point.tmp\n");
+#endif
+        exit(-2);
+    }
+    fprintf(fp,"%d %d\n",step,N_tot_trials);
+    for(i=0;i<N_OUTPUT_FILES;i++)
+        fprintf(fp,"%ld ",file_size[i]);
+    fprintf(fp,"\n");
+    fflush(fp);
+    fsync(fileno(fp));
+    fclose(fp);
+    rename("saving_point.tmp","saving_point.txt");
+}
+
+/*return 0 if saving_point.txt was written by an older version of the program, which did not record the sizes*/
+static int read_output_file_sizes(long file_size[N_OUTPUT_FILES])
+{
+    int i,int_buffer;
+    FILE *fp;
+    fp=fopen("saving_point.txt","r");
+    if(fp==NULL)
+        return 0;
+    fscanf(fp,"%d %d",&int_buffer,&int_buffer);
+    for(i=0;i<N_OUTPUT_FILES;i++)
+    {
+        if(fscanf(fp,"%ld",&(file_size[i]))!=1)
+            break;
+    }
+    fclose(fp);
+    return i==N_OUTPUT_FILES;
+}
+
+#if BINARY_CHECKPOINT
+/*write the state of the simulation at a saving point to checkpoint.tmp, 
+ *then rename it to checkpoint.bin, so that checkpoint.bin is always complete*/
+static void save_checkpoint(Genotype *resident, 
+                            Mutation *mut_record, 
+                            int step, 
+                            int N_tot_trials, 
+                            int max_TFBS_number,
+                            RngStream RS_main, 
+                            RngStream RS_parallel[N_THREADS])
+{
+    int i;
+    char *name;
+    CheckpointHeader header;
+    FILE *fp;
+    
+    memset(&header,0,sizeof(CheckpointHeader));
+    memcpy(header.magic,"NSCHKPNT",8);
+    header.version=CHECKPOINT_VERSION;
+    header.size_of_genotype=sizeof(Genotype);
+    header.size_of_rng_stream=sizeof(struct RngStream_InfoState);
+    header.n_threads=N_THREADS;
+    header.step=step;
+    header.N_tot_trials=N_tot_trials;
+    header.max_TFBS_number=max_TFBS_number;
+    header.N_output_files=N_OUTPUT_FILES;
+    measure_output_files(header.file_size);
+    
+    fp=fopen("checkpoint.tmp","wb");
+    if(fp==NULL)
+    {
+        printf("Cannot write checkpoint.tmp! Quit program!\n");
+#if MAKE_LOG
+        LOG("cannot write checkpoint.tmp\n");
+#endif
+        exit(-2);
+    }
+    fwrite(&header,sizeof(CheckpointHeader),1,fp);
+    write_genotype(fp,resident);
+    fwrite(mut_record,sizeof(Mutation),1,fp);
+    /*names of rng streams are pointers, which are kept by load_checkpoint*/
+    name=RS_main->name;
+    RS_main->name=NULL;
+    fwrite(RS_main,sizeof(struct RngStream_InfoState),1,fp);
+    RS_main->name=name;
+    for(i=0;i<N_THREADS;i++)
+    {
+        name=RS_parallel[i]->name;
+        RS_parallel[i]->name=NULL;
+        fwrite(RS_parallel[i],sizeof(struct RngStream_InfoState),1,fp);
+        RS_parallel[i]->name=name;
+    }
+    fflush(fp);
+    fsync(fileno(fp));
+    if(ferror(fp))
+    {
+        printf("Cannot write checkpoint.tmp! Quit program!\n");
+#if MAKE_LOG
+        LOG("cannot write checkpoint.tmp\n");
+#endif
+        exit(-2);
+    }
+    fclose(fp);
+    rename("checkpoint.tmp","checkpoint.bin");
+}
+
+/*Restore the resident, the mutation record, the rng streams and N_tot_trials from checkpoint.bin, 
+ *and truncate output files to their sizes at the checkpoint. Return 0, without changing 
+ *anything, if checkpoint.bin is missing, was made by a different build, or was not saved at step replay_N_steps*/
+static int load_checkpoint( Genotype *resident, 
+                            Mutation *mut_record, 
+                            int replay_N_steps, 
+                            int *N_tot_trials, 
+                            RngStream RS_main, 
+                            RngStream RS_parallel[N_THREADS])
+{
+    int i;
+    long expected_size;
+    char *name;
+    CheckpointHeader header;
+    FILE *fp;
+    
+    fp=fopen("checkpoint.bin","rb");
+    if(fp==NULL)
+        return 0;
+    expected_size=sizeof(CheckpointHeader)+sizeof(Genotype)+sizeof(Mutation)+(N_THREADS+1)*sizeof(struct RngStream_InfoState);
+    fseek(fp,0,SEEK_END);
+    if(ftell(fp)!=expected_size ||
+        fseek(fp,0,SEEK_SET)!=0 ||
+        fread(&header,sizeof(CheckpointHeader),1,fp)!=1 ||
+        memcmp(header.magic,"NSCHKPNT",8)!=0 ||
+        header.version!=CHECKPOINT_VERSION ||
+        header.size_of_genotype!=sizeof(Genotype) ||
+        header.size_of_rng_stream!=sizeof(struct RngStream_InfoState) ||
+        header.n_threads!=N_THREADS ||
+        header.N_output_files!=N_OUTPUT_FILES ||
+        header.step!=replay_N_steps)
+    {
+        printf("checkpoint.bin does not match saving_point.txt. Replay mutations instead.\n");
+        fclose(fp);
+        return 0;
+    }
+    
+    read_genotype(fp,resident);
+    fread(mut_record,sizeof(Mutation),1,fp);
+    
+    /*rng streams keep their names*/
+    name=RS_main->name;
+    fread(RS_main,sizeof(struct RngStream_InfoState),1,fp);
+    RS_main->name=name;
+    for(i=0;i<N_THREADS;i++)
+    {
+        name=RS_parallel[i]->name;
+        fread(RS_parallel[i],sizeof(struct RngStream_InfoState),1,fp);
+        RS_parallel[i]->name=name;
+    }
+    fclose(fp);
+    
+    MAX_TFBS_NUMBER=header.max_TFBS_number;
+    calc_all_binding_sites(resident);
+    *N_tot_trials=header.N_tot_trials;
+    
+    truncate_output_files(header.file_size);
+    printf("LOAD CHECKPOINT SUCCESSFUL!\n");
+    return 1;
+}
+#endif
+
+#if BINARY_CHECKPOINT || INDEXED_MUTATION_LOG
+/*binding sites are recalculated after loading, so the pointers to them are written as NULL*/
+static void write_genotype(FILE *fp, Genotype *genotype)
+{
+    AllTFBindingSites *all_binding_sites[MAX_GENES];
+    int N_allocated_elements;
+    
+    memcpy(all_binding_sites,genotype->all_binding_sites,MAX_GENES*sizeof(AllTFBindingSites *));
+    N_allocated_elements=genotype->N_allocated_elements;
+    memset(genotype->all_binding_sites,0,MAX_GENES*sizeof(AllTFBindingSites *));
+    genotype->N_allocated_elements=0;
+    fwrite(genotype,sizeof(Genotype),1,fp);
+    memcpy(genotype->all_binding_sites,all_binding_sites,MAX_GENES*sizeof(AllTFBindingSites *));
+    genotype->N_allocated_elements=N_allocated_elements;
+}
+#endif
+
+#if BINARY_CHECKPOINT || (INDEXED_MUTATION_LOG && (PHENOTYPE || PERTURB))
+/*binding sites are not saved. Keep the arrays allocated to the genotype, and mark binding sites for recalculation*/
+static void read_genotype(FILE *fp, Genotype *genotype)
+{
+    int i;
+    AllTFBindingSites *all_binding_sites[MAX_GENES];
+    int N_allocated_elements;
+    
+    memcpy(all_binding_sites,genotype->all_binding_sites,MAX_GENES*sizeof(AllTFBindingSites *));
+    N_allocated_elements=genotype->N_allocated_elements;
+    fread(genotype,sizeof(Genotype),1,fp);
+    memcpy(genotype->all_binding_sites,all_binding_sites,MAX_GENES*sizeof(AllTFBindingSites *));
+    genotype->N_allocated_elements=N_allocated_elements;
+    for(i=0;i<MAX_GENES;i++)
+        genotype->recalc_TFBS[i]=YES;
+}
+#endif
+
+#if INDEXED_MUTATION_LOG
+/* mutations.bin has a header followed by one Mutation per step, so the 
+ * mutation accepted at step i starts at MUTATION_LOG_HEADER_SIZE+(i-1)*sizeof(Mutation).
+ */
+#define MUTATION_LOG_HEADER_SIZE (8+sizeof(int))
+/* genotypes.bin has a header followed by the resident at step 0, SNAPSHOT_INTERVAL, 2*SNAPSHOT_INTERVAL, ...*/
+#define SNAPSHOT_HEADER_SIZE (8+2*sizeof(int))
+
+static void append_mutations(Output_buffer *resident_info, int N)
+{
+    int i,size=sizeof(Mutation);
+    Mutation mut_record;
+    FILE *fp;
+    
+    fp=fopen("mutations.bin","ab");
+    if(fp==NULL)
+    {
+        printf("Cannot write mutations.bin! Quit program!\n");
+#if MAKE_LOG
+        LOG("cannot write mutations.bin\n");
+#endif
+        exit(-2);
+    }
+    if(ftell(fp)==0)
+    {
+        fwrite("NSMUTLG1",1,8,fp);
+        fwrite(&size,sizeof(int),1,fp);
+    }
+    for(i=0;i<N;i++)
+    {
+        memset(&mut_record,0,sizeof(Mutation));
+        mut_record.mut_type=resident_info[i].mut_type;
+        mut_record.which_gene=resident_info[i].which_gene;
+        mut_record.which_nucleotide=resident_info[i].which_nuc;
+        memcpy(mut_record.nuc_diff,resident_info[i].new_nuc,3);
+        mut_record.kinetic_type=resident_info[i].which_kinetic;
+        mut_record.kinetic_diff=resident_info[i].new_kinetic;
+        fwrite(&mut_record,sizeof(Mutation),1,fp);
+    }
+    fclose(fp);
+}
+
+static void save_genotype_snapshot(Genotype *genotype, int step)
+{
+    int header[2]={SNAPSHOT_INTERVAL,sizeof(Genotype)};
+    FILE *fp;
+    
+    fp=fopen("genotypes.bin","r+b");
+    if(fp==NULL)
+    {
+        fp=fopen("genotypes.bin","wb");
+        if(fp==NULL)
+        {
+            printf("Cannot write genotypes.bin! Quit program!\n");
+#if MAKE_LOG
+            LOG("cannot write genotypes.bin\n");
+#endif
+            exit(-2);
+        }
+        fwrite("NSGENOT1",1,8,fp);
+        fwrite(header,sizeof(int),2,fp);
+    }
+    /*write at the position of the snapshot, so a snapshot left by an interrupted run is overwritten*/
+    fseek(fp,SNAPSHOT_HEADER_SIZE+(long)(step/SNAPSHOT_INTERVAL)*sizeof(Genotype),SEEK_SET);
+    write_genotype(fp,genotype);
+    fclose(fp);
+}
+
+#if PHENOTYPE || PERTURB
+/*open mutations.bin at the mutation accepted at first_step*/
+static FILE *open_mutation_log(int first_step)
+{
+    char magic[8];
+    int size;
+    FILE *fp;
+    
+    fp=fopen("mutations.bin","rb");
+    if(fp==NULL || 
+        fread(magic,1,8,fp)!=8 || 
+        memcmp(magic,"NSMUTLG1",8)!=0 ||
+        fread(&size,sizeof(int),1,fp)!=1 || 
+        size!=sizeof(Mutation) ||
+        fseek(fp,MUTATION_LOG_HEADER_SIZE+(long)(first_step-1)*sizeof(Mutation),SEEK_SET)!=0)
+    {
+        printf("Loading mutations.bin failed! Quit program!");
+#if MAKE_LOG
+        LOG("Loading mutations.bin failed!");
+#endif
+        exit(-2);
+    }
+    return fp;
+}
+
+/*returns 0 at the end of the log*/
+static int read_mutation(FILE *fp, Mutation *mut_record)
+{
+    if(fread(mut_record,sizeof(Mutation),1,fp)!=1)
+        return 0;
+    /*reproduce_mutate reads the nucleotide from where mutation_file puts it*/
+    mut_record->nuc_diff[1]=mut_record->nuc_diff[0];
+    return 1;
+}
+
+/* load the nearest snapshot at or before step, then replay at most 
+ * SNAPSHOT_INTERVAL-1 mutations to reach the genotype at step.
+ */
+static void reconstruct_genotype(Genotype *genotype, Mutation *mut_record, int step)
+{
+    int i,header[2],first_step;
+    char magic[8];
+    FILE *fp;
+    
+    first_step=step-step%SNAPSHOT_INTERVAL;
+    fp=fopen("genotypes.bin","rb");
+    if(fp==NULL || 
+        fread(magic,1,8,fp)!=8 || 
+        memcmp(magic,"NSGENOT1",8)!=0 ||
+        fread(header,sizeof(int),2,fp)!=2 || 
+        header[0]!=SNAPSHOT_INTERVAL || 
+        header[1]!=sizeof(Genotype))
+    {
+        printf("Loading genotypes.bin failed! Quit program!");
+#if MAKE_LOG
+        LOG("Loading genotypes.bin failed!");
+#endif
+        exit(-2);
+    }
+    fseek(fp,0,SEEK_END);
+    if(ftell(fp)<(long)(SNAPSHOT_HEADER_SIZE+(first_step/SNAPSHOT_INTERVAL+1)*sizeof(Genotype)))
+    {
+        printf("genotypes.bin has no snapshot at step %d! Quit program!",first_step);
+#if MAKE_LOG
+        LOG("genotypes.bin has no snapshot at step %d!",first_step);
+#endif
+        exit(-2);
+    }
+    fseek(fp,SNAPSHOT_HEADER_SIZE+(long)(first_step/SNAPSHOT_INTERVAL)*sizeof(Genotype),SEEK_SET);
+    read_genotype(fp,genotype);
+    fclose(fp);
+    
+    if(step==first_step)
+        return;
+    fp=open_mutation_log(first_step+1);
+    for(i=first_step+1;i<=step;i++)
+    {
+        if(!read_mutation(fp,mut_record))
+        {
+            printf("mutations.bin ends before step %d! Quit program!",i);
+#if MAKE_LOG
+            LOG("mutations.bin ends before step %d!",i);
+#endif
+            exit(-2);
+        }
+        reproduce_mutate(genotype,mut_record);
+    }
+    fclose(fp);
+}
+#endif
+#endif
+
+#if ASYNC_OUTPUT
+static void start_output_writer(void)
+{
+    int i;
+    for(i=0;i<2;i++)
+    {
+        if(output_jobs[i].mutant_info==NULL)
+        {
+            output_jobs[i].mutant_info_size=OUTPUT_INTERVAL*50;
+            output_jobs[i].mutant_info=(Output_buffer *)malloc(output_jobs[i].mutant_info_size*sizeof(Output_buffer));
+        }
+    }
+    writer_quit=0;
+    if(pthread_create(&writer_thread,NULL,run_output_writer,NULL)!=0)
+    {
+        printf("Cannot create the writer thread! Quit program!\n");
+#if MAKE_LOG
+        LOG("cannot create the writer thread\n");
+#endif
+        exit(-2);
+    }
+}
+
+/*copy what is to be output at the end of an interval to the job being filled, 
+ *wait until the writer has finished the previous job, and hand over the job*/
+static void submit_output_job(  Genotype *resident, 
+                                Mutation *mut_record, 
+                                Output_buffer resident_info[OUTPUT_INTERVAL], 
+                                int N_resident_records, 
+                                int N_mutant_records, 
+                                int step, 
+                                int N_tot_trials, 
+                                int flag_saving_point, 
+                                RngStream RS_main, 
+                                RngStream RS_parallel[N_THREADS])
+{
+    int i;
+    AllTFBindingSites *all_binding_sites[MAX_GENES];
+    OutputJob *job;
+    
+    job=&(output_jobs[job_being_filled]);
+    job->step=step;
+    job->N_tot_trials=N_tot_trials;
+    job->flag_saving_point=flag_saving_point;
+    job->N_mutant_records=N_mutant_records;
+    job->N_resident_records=0;
+    if(flag_saving_point)
+    {
+        memcpy(job->resident_info,resident_info,N_resident_records*sizeof(Output_buffer));
+        job->N_resident_records=N_resident_records;
+    }
+    
+    /*copy the resident, with its binding sites in arrays of the job*/
+    memcpy(all_binding_sites,job->resident.all_binding_sites,MAX_GENES*sizeof(AllTFBindingSites *));
+    if(job->N_allocated_binding_sites<resident->N_allocated_elements)
+    {
+        for(i=0;i<MAX_GENES;i++)
+            all_binding_sites[i]=(AllTFBindingSites *)realloc(all_binding_sites[i],resident->N_allocated_elements*sizeof(AllTFBindingSites));
+        job->N_allocated_binding_sites=resident->N_allocated_elements;
+    }
+    memcpy(&(job->resident),resident,sizeof(Genotype));
+    memcpy(job->resident.all_binding_sites,all_binding_sites,MAX_GENES*sizeof(AllTFBindingSites *));
+    for(i=0;i<resident->ngenes;i++)
+        memcpy(all_binding_sites[i],resident->all_binding_sites[i],resident->binding_sites_num[i]*sizeof(AllTFBindingSites));
+    
+#if OUTPUT_RNG_SEEDS
+    RngStream_GetState(RS_main,job->rng_seeds[0]);
+    for(i=0;i<N_SAVED_PARALLEL_STREAMS;i++)
+        RngStream_GetState(RS_parallel[i],job->rng_seeds[i+1]);
+#endif
+#if BINARY_CHECKPOINT
+    job->mut_record=*mut_record;
+    job->rng_states[0]=*RS_main;
+    for(i=0;i<N_THREADS;i++)
+        job->rng_states[i+1]=*(RS_parallel[i]);
+    job->max_TFBS_number=MAX_TFBS_NUMBER;
+#endif
+    
+    pthread_mutex_lock(&writer_lock);
+    while(job_pending)
+        pthread_cond_wait(&writer_cond,&writer_lock);
+    job_to_write=job_being_filled;
+    job_pending=1;
+    pthread_cond_broadcast(&writer_cond);
+    pthread_mutex_unlock(&writer_lock);
+    job_being_filled=1-job_being_filled;
+}
+
+/*return after the writer has written the job submitted last*/
+static void stop_output_writer(void)
+{
+    pthread_mutex_lock(&writer_lock);
+    writer_quit=1;
+    pthread_cond_broadcast(&writer_cond);
+    pthread_mutex_unlock(&writer_lock);
+    pthread_join(writer_thread,NULL);
+}
+
+static void *run_output_writer(void *arg)
+{
+    OutputJob *job;
+    while(1)
+    {
+        pthread_mutex_lock(&writer_lock);
+        while(!job_pending && !writer_quit)
+            pthread_cond_wait(&writer_cond,&writer_lock);
+        if(!job_pending)
+        {
+            pthread_mutex_unlock(&writer_lock);
+            return NULL;
+        }
+        job=&(output_jobs[job_to_write]);
+        pthread_mutex_unlock(&writer_lock);
+        
+        write_output_job(job);
+        
+        pthread_mutex_lock(&writer_lock);
+        job_pending=0;
+        pthread_cond_broadcast(&writer_cond);
+        pthread_mutex_unlock(&writer_lock);
+    }
+}
+
+/*write the files in the same order as evolve_N_steps does without ASYNC_OUTPUT*/
+static void write_output_job(OutputJob *job)
+{
+    int i;
+    FILE *fp;
+#if BINARY_CHECKPOINT
+    RngStream rng_states[N_THREADS];
+#endif
+    
+    summarize_binding_sites(&(job->resident),job->step);
+#if OUTPUT_MUTANT_DETAILS
+    output_mutant_info(job->mutant_info,job->N_mutant_records);
+#endif
+    if(job->flag_saving_point)
+    {
+        output_resident_info(job->resident_info,job->N_resident_records,1); //magic number 1 means to output everything
+#if OUTPUT_RNG_SEEDS
+        fp=fopen("RngSeeds.txt","a+");
+        for(i=0;i<=N_SAVED_PARALLEL_STREAMS;i++)
+            fprintf(fp,"%lu %lu %lu %lu %lu %lu ",job->rng_seeds[i][0],job->rng_seeds[i][1],job->rng_seeds[i][2],job->rng_seeds[i][3],job->rng_seeds[i][4],job->rng_seeds[i][5]);
+        fprintf(fp,"\n");
+        fflush(fp);
+        fclose(fp);
+#endif
+#if INDEXED_MUTATION_LOG
+        if(job->step%SNAPSHOT_INTERVAL==0)
+            save_genotype_snapshot(&(job->resident),job->step);
+#endif
+        write_saving_point(job->step,job->N_tot_trials);
+#if BINARY_CHECKPOINT
+        for(i=0;i<N_THREADS;i++)
+            rng_states[i]=&(job->rng_states[i+1]);
+        save_checkpoint(&(job->resident),&(job->mut_record),job->step,job->N_tot_trials,job->max_TFBS_number,&(job->rng_states[0]),rng_states);
+#endif
+    }
+}
+#endif
+
+void print_mutatable_parameters(Genotype *genotype,int init_or_end)
+{
+    int i;
+    FILE *fp;    
+    if(init_or_end==1)
+        fp=fopen("end_mutatable_parameters.txt","w");
+    else
+        fp=fopen("init_mutatable_parameters.txt","w");
+    
+    for(i=0;i<genotype->ngenes;i++)
+    {
+        fprintf(fp,"%f %f %f %f %d ",genotype->active_to_intermediate_rate[i],
+                                    genotype->mRNA_decay_rate[i],
+                                    genotype->translation_rate[i],
+                                    genotype->protein_decay_rate[i],
+                                    genotype->locus_length[i]);
+        if(genotype->protein_identity[genotype->which_protein[i]]!=-1) //is a tf gene
+            fprintf(fp,"%f\n",log10(genotype->Kd[genotype->which_protein[i]]));
+        else
+             fprintf(fp,"na\n");
+    }
+    fclose(fp);
+}
+
+static void store_resident_info(Genotype *resident, 
+                                Mutation *mut_record, 
+                                Output_buffer *resident_info, 
+                                int evo_step, 
+                                int N_mutations_at_current_step, 
+                                int N_tot_mutations, 
+                                float selection_coefficient, 
+                                int flag)
+{  
+    int i;
+ 
+   /*always store network motifs*/
+    for(i=0;i<36;i++)
+        resident_info->n_motifs[i]=resident->N_motifs[i];
     for(i=0;i<12;i++)        
         resident_info->n_near_AND_gated_motifs[i]=resident->N_near_AND_gated_motifs[i];
     
@@ -3194,6 +5402,8 @@ static void store_resident_info(Genotype *resident,
         resident_info->se_avg_f=resident->SE_avg_fitness;
         resident_info->se_f1=resident->SE_fitness1;
         resident_info->se_f2=resident->SE_fitness2;
+        resident_info->variance_reduction=resident->variance_reduction;
+        resident_info->n_replicates=resident->N_fitness_measurements;
     
         if(flag==1) //if stores everthing
         {
@@ -3228,6 +5438,9 @@ static void store_mutant_info(Genotype *mutant, Mutation *mut_record, Output_buf
     mutant_info->se_avg_f=mutant->SE_avg_fitness;
     mutant_info->se_f1=mutant->SE_fitness1;
     mutant_info->se_f2=mutant->SE_fitness2;
+    mutant_info->avg_f_diff=mutant->avg_fitness_diff;
+    mutant_info->se_avg_f_diff=mutant->SE_avg_fitness_diff;
+    mutant_info->variance_reduction=mutant->variance_reduction;
     mutant_info->step=step;
     mutant_info->n_tot_mut=N_tot_mutations;
     mutant_info->mut_type=mut_record->mut_type;
@@ -3242,10 +5455,23 @@ static void store_mutant_info(Genotype *mutant, Mutation *mut_record, Output_buf
 
 static void output_mutant_info(Output_buffer *mutant_info, int N_mutant)
 {
+#if BINARY_OUTPUT
+    write_records("mutants.bin",mutant_fields,sizeof(mutant_fields)/sizeof(RecordField),mutant_info,N_mutant);
+#else
     int i;
     FILE *fp;    
+#if COMPRESS_MUTANT_LOGS
+    /*format the records in memory, then append them to the gzip files as one block*/
+    char *text;
+    size_t text_size;
+    long offset_mutations,offset_fitness;
+    if(N_mutant==0)
+        return;
+    fp=open_memstream(&text,&text_size);
+#else
     /*output mutation*/
     fp=fopen("all_mutations.txt","a+");
+#endif
     for(i=0;i<N_mutant;i++)        
         fprintf(fp,"%d %d %c %d %d '%s' %d %a\n",
                 mutant_info[i].step,
@@ -3258,19 +5484,54 @@ static void output_mutant_info(Output_buffer *mutant_info, int N_mutant)
                 mutant_info[i].new_kinetic);
     fflush(fp);
     fclose(fp);
+#if COMPRESS_MUTANT_LOGS
+    offset_mutations=append_compressed_block("all_mutations.txt.gz",text,text_size);
+    free(text);
+#endif
     
     /*output mutant fitness, which is low-resolution*/  
+#if COMPRESS_MUTANT_LOGS
+    fp=open_memstream(&text,&text_size);
+#else
     fp=fopen("fitness_all_mutants.txt","a+");
+#endif
     for(i=0;i<N_mutant;i++) 
-        fprintf(fp,"%.10f %.10f %.10f %.10f %.10f %.10f\n", 
+    {
+        fprintf(fp,"%.10f %.10f %.10f %.10f %.10f %.10f", 
             mutant_info[i].avg_f,
             mutant_info[i].f1,
             mutant_info[i].f2,
             mutant_info[i].se_avg_f,
             mutant_info[i].se_f1,
             mutant_info[i].se_f2);
+#if COMMON_RANDOM_NUMBERS
+        fprintf(fp," %.10f %.10f", 
+            mutant_info[i].avg_f_diff,
+            mutant_info[i].se_avg_f_diff);
+#endif
+#if STRATIFIED_BURN_IN || ANTITHETIC_REPLICATES
+        fprintf(fp," %.4f",mutant_info[i].variance_reduction);
+#endif
+#if MEAN_FIELD_PRESCREEN
+        fprintf(fp," %.10f %.10f %d",
+            mutant_info[i].mean_field_f,
+            mutant_info[i].mean_field_resident_f,
+            mutant_info[i].screened_out);
+#endif
+        fprintf(fp,"\n");
+    }
     fflush(fp);
     fclose(fp); 
+#if COMPRESS_MUTANT_LOGS
+    offset_fitness=append_compressed_block("fitness_all_mutants.txt.gz",text,text_size);
+    free(text);
+    /*the first step and the number of mutants of each block, and where the block starts in the two files*/
+    fp=fopen("mutant_log_index.txt","a+");
+    fprintf(fp,"%d %d %ld %ld\n",mutant_info[0].step,N_mutant,offset_mutations,offset_fitness);
+    fflush(fp);
+    fclose(fp);
+#endif
+#endif
 }
 
 static void output_resident_info(Output_buffer resident_info[OUTPUT_INTERVAL], int output_counter, int flag)
@@ -3278,6 +5539,17 @@ static void output_resident_info(Output_buffer resident_info[OUTPUT_INTERVAL], i
     int i,j;
     FILE *fp;   
     
+#if INDEXED_MUTATION_LOG
+    if(flag==1)
+        append_mutations(resident_info,output_counter);
+#endif
+#if BINARY_OUTPUT
+    if(flag==1) //if function is not called by replay_mutation
+    {
+        write_records("residents.bin",resident_fields,sizeof(resident_fields)/sizeof(RecordField),resident_info,output_counter);
+        return;
+    }
+#endif
     /*output motifs*/
     fp=fopen("N_motifs.txt","a+");
     for(j=0;j<output_counter;j++)
@@ -3317,7 +5589,8 @@ static void output_resident_info(Output_buffer resident_info[OUTPUT_INTERVAL], i
         /*output precise fitness */
         fp=fopen("precise_fitness.txt","a+"); 
         for(i=0;i<output_counter;i++)
-            fprintf(fp,"%d %d %a %a %a %a %a %a\n",resident_info[i].n_tot_mut, 
+        {
+            fprintf(fp,"%d %d %a %a %a %a %a %a",resident_info[i].n_tot_mut, 
                                                     resident_info[i].n_hit_bound,
                                                     resident_info[i].avg_f,                                                
                                                     resident_info[i].f1,
@@ -3325,6 +5598,14 @@ static void output_resident_info(Output_buffer resident_info[OUTPUT_INTERVAL], i
                                                     resident_info[i].se_avg_f,
                                                     resident_info[i].se_f1,
                                                     resident_info[i].se_f2); 
+#if STRATIFIED_BURN_IN || ANTITHETIC_REPLICATES
+            fprintf(fp," %a",resident_info[i].variance_reduction);
+#endif
+#if ADAPTIVE_HI_RESOLUTION
+            fprintf(fp," %d",resident_info[i].n_replicates);
+#endif
+            fprintf(fp,"\n");
+        }
         fflush(fp);
         fclose(fp);  
 
@@ -3351,4 +5632,101 @@ static void output_resident_info(Output_buffer resident_info[OUTPUT_INTERVAL], i
         fflush(fp);
         fclose(fp);
     }
-}
\ No newline at end of file
+}
+
+#if BINARY_OUTPUT
+/*append records to a file of fixed-width records. A new file starts with the description of the columns*/
+static void write_records(char *file_name, const RecordField *fields, int N_fields, Output_buffer *records, int N_records)
+{
+    int i,j,k,pos,record_size,width[N_fields];
+    short int16;
+    char *src;
+    OutputColumn column;
+    FILE *fp;
+    
+    record_size=0;
+    for(i=0;i<N_fields;i++)
+    {
+        width[i]=(fields[i].type=='c')?1:((fields[i].type=='s')?2:4);
+        record_size+=width[i]*fields[i].count;
+    }
+    char record[record_size];
+    
+    fp=fopen(file_name,"ab");
+    if(fp==NULL)
+    {
+        printf("Cannot write %s! Quit program!\n",file_name);
+#if MAKE_LOG
+        LOG("cannot write %s\n",file_name);
+#endif
+        exit(-2);
+    }
+    fseek(fp,0,SEEK_END);
+    if(ftell(fp)==0)
+    {
+        fwrite("NSRECRD1",1,8,fp);
+        fwrite(&N_fields,sizeof(int),1,fp);
+        fwrite(&record_size,sizeof(int),1,fp);
+        pos=0;
+        for(i=0;i<N_fields;i++)
+        {
+            memset(&column,0,sizeof(OutputColumn));
+            strncpy(column.name,fields[i].name,sizeof(column.name)-1);
+            column.type=fields[i].type;
+            column.count=fields[i].count;
+            column.offset=pos;
+            pos+=width[i]*fields[i].count;
+            fwrite(&column,sizeof(OutputColumn),1,fp);
+        }
+    }
+    for(k=0;k<N_records;k++)
+    {
+        pos=0;
+        for(i=0;i<N_fields;i++)
+        {
+            src=(char *)&(records[k])+fields[i].offset_in_buffer;
+            if(fields[i].type=='s')
+            {
+                for(j=0;j<fields[i].count;j++)
+                {
+                    int16=(short)((int *)src)[j];
+                    memcpy(record+pos+2*j,&int16,2);
+                }
+            }
+            else
+                memcpy(record+pos,src,width[i]*fields[i].count);
+            pos+=width[i]*fields[i].count;
+        }
+        fwrite(record,record_size,1,fp);
+    }
+    fflush(fp);
+    fclose(fp);
+}
+#endif
+
+#if COMPRESS_MUTANT_LOGS
+/*append data to a gzip file as a new gzip member, and return the offset at which the member starts*/
+static long append_compressed_block(char *file_name, char *data, size_t size)
+{
+    long offset=0;
+    FILE *fp;
+    gzFile gz;
+    fp=fopen(file_name,"r");
+    if(fp!=NULL)
+    {
+        fseek(fp,0,SEEK_END);
+        offset=ftell(fp);
+        fclose(fp);
+    }
+    gz=gzopen(file_name,"ab");
+    if(gz==NULL || gzwrite(gz,data,size)!=(int)size || gzclose(gz)!=Z_OK)
+    {
+        printf("Cannot write %s! Quit program!\n",file_name);
+#if MAKE_LOG
+        LOG("cannot write %s\n",file_name);
+#endif
+        exit(-2);
+    }
+    return offset;
+}
+#endif
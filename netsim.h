@@ -41,9 +41,55 @@
 #define N_THREADS 10 //the number of parallel OpenMP threads
 #define N_REPLICATES 200 //calculate the fitness of a mutant with 200 replicates
 #define HI_RESOLUTION_RECALC 5 //calcualte the fitness of a resident with 5*N_REPLICATES replicates
+#define ADAPTIVE_HI_RESOLUTION 0 //stop recalculating the fitness of a new resident once its SE is small enough, using at most HI_RESOLUTION_RECALC batches
+#define TARGET_RELATIVE_SE 0.0005 //the SE of fitness that is small enough, relative to fitness
 #define OUTPUT_INTERVAL 20 //pool results from evolutionary steps before writing to disk
 #define OUTPUT_MUTANT_DETAILS 1 //output every mutant genotype and its fitness, whetehr the mutant is accepted
 #define OUTPUT_RNG_SEEDS 1 //output the state of random number generator every evolutionary step
+#define COMMON_RANDOM_NUMBERS 0 //replicate r of the resident and of every mutant at an evolutionary step uses the same rng substream, 
+                                //so that the fitness of a mutant is compared with that of the resident replicate by replicate
+#define THREAD_INVARIANT_RNG 0 //replicate r draws from a substream of RS_parallel[0] indexed by r, whichever thread runs it, so that results do not depend on N_THREADS
+#if THREAD_INVARIANT_RNG
+#define N_SAVED_PARALLEL_STREAMS 1 //RngSeeds.txt stores the states of RS_main and RS_parallel[0] only
+#else
+#define N_SAVED_PARALLEL_STREAMS N_THREADS
+#endif
+#define STRATIFIED_BURN_IN 0 //replicate r of N_REPLICATES draws the duration of burn-in from the rth of N_REPLICATES equally probable strata
+#define ANTITHETIC_REPLICATES 0 //replicate 2m+1 replays the random numbers of replicate 2m antithetically
+#if ANTITHETIC_REPLICATES && (N_REPLICATES/N_THREADS)%2!=0
+#error "ANTITHETIC_REPLICATES requires an even number of replicates per thread"
+#endif
+#if STRATIFIED_BURN_IN && (N_REPLICATES/(ANTITHETIC_REPLICATES+1))%2!=0
+#error "STRATIFIED_BURN_IN requires an even number of replicates (of antithetic pairs)"
+#endif
+#define MEAN_FIELD_PRESCREEN 0 //1 skips simulating mutants whose fitness predicted by a deterministic mean-field model is far below that of the resident,
+                               //2 only records the predictions, to assess how often the screen would reject a mutant that can fix
+#define MEAN_FIELD_MARGIN 0.002 //a mutant is screened out if its predicted fitness is lower than that of the resident by more than this fraction
+#define TAU_LEAPING 0 //1 simulates the promoters of genes with fast promoter events between the other events, without recalculating all rates after each promoter event
+#define TAU_LEAPING_MIN_RATE 5.0 //a gene is fast if its promoter changes state or initiates transcription at least this often (per min)
+#define LUMP_IDENTICAL_COPIES 0 //simulate the copies of a gene that share cis-reg sequence, protein and kinetic constants as one gene with multiple promoters. Ignored when PHENOTYPE is 1
+#define CLOSED_FORM_TPRIME 0 //1 solves the time at which a protein encoded by a single gene reaches a threshold in closed form instead of by Newton-Raphson, and reuses the decay factors of protein numbers in the integration of fitness. This changes results slightly
+#define FAST_EXP 0 //1 updates protein numbers with a polynomial exp (relative error < 3e-7) that the compiler can vectorize over genes. This changes results slightly
+#define BINARY_OUTPUT 0 //1 writes the records of residents and mutants to residents.bin and mutants.bin instead of text files. Convert them to text with convert_output
+#define COMPRESS_MUTANT_LOGS 0 //1 writes all_mutations.txt and fitness_all_mutants.txt as gzip files, one block per OUTPUT_INTERVAL, indexed in mutant_log_index.txt. Read them with read_mutant_log. Requires zlib
+#define ASYNC_OUTPUT 0 //1 writes the output of an OUTPUT_INTERVAL on a separate thread while evolution continues. Each saving point is still written after the output it marks
+#define INDEXED_MUTATION_LOG 0 //1 also writes accepted mutations to mutations.bin and the resident at every SNAPSHOT_INTERVAL steps to genotypes.bin, 
+                                //from which PHENOTYPE and PERTURB modes rebuild the genotype at a step with at most SNAPSHOT_INTERVAL replays
+#define SNAPSHOT_INTERVAL 1000 //must be a multiple of OUTPUT_INTERVAL
+#if INDEXED_MUTATION_LOG && SNAPSHOT_INTERVAL%OUTPUT_INTERVAL!=0
+#error "SNAPSHOT_INTERVAL must be a multiple of OUTPUT_INTERVAL"
+#endif
+#define TOPOLOGY_STREAM 0 //1 writes the networks to topology.bin, as changes from the previous network, instead of to networks.txt. Render them as text with render_topology
+#define TOPOLOGY_KEYFRAME_INTERVAL 50 //every this many networks, the whole network is written instead of the changes
+#define INCREMENTAL_MOTIF_COUNT 0 //1 reuses the motifs counted at an effector gene until the binding sites and TFs that they depend on change. Ignored under PERTURB and SAMPLE_PARAMETERS, which mark genes while counting
+#define BINARY_CHECKPOINT 0 //1 also saves the resident genotype, the states of all rng streams and the sizes of output files to checkpoint.bin at every saving point, so that a simulation resumes without replaying mutations
+#define FIXED_EVENT_STATS 0 //1 appends the number of fixed events and of the slabs malloc'ed to hold them to fixed_event_stats.txt after every calculation of fitness
+#if BINARY_OUTPUT && !BINARY_CHECKPOINT
+#error "BINARY_OUTPUT requires BINARY_CHECKPOINT, because mutations cannot be replayed from residents.bin"
+#endif
+#if COMPRESS_MUTANT_LOGS && BINARY_OUTPUT
+#error "COMPRESS_MUTANT_LOGS compresses the text logs, which are not written under BINARY_OUTPUT"
+#endif
 #define MAKE_LOG 0 //generate error log
 #if MAKE_LOG
 #define LOG(...) { FILE *fperror; fperror=fopen("error.txt","a+"); fprintf(fperror, "%s: ", __func__); fprintf (fperror, __VA_ARGS__) ; fflush(fperror); fclose(fperror);} 
@@ -68,7 +114,16 @@
                        // 3 samples from isolated AND-gated FFL-in-diamonds
 #define REPRODUCE_GENOTYPES 0 // output N_motifs and networks of all accepted mutations, 
                               // can be used together with options in section 6
+#define LAZY_REPLAY 0 // 1 to score the replayed genotypes only at every OUTPUT_INTERVAL steps,
+                      // so N_motifs.txt gets a line for each genotype in networks.txt
 #define SAMPLE_GENE_EXPRESSION 0 //output expression of genes
+#define AGGREGATE_EXPRESSION 0 // 1 to output the mean, variance and quantiles of expression and fitness at each time point
+                               // over replicates (expression_A.txt and expression_B.txt), instead of the timecourse of every replicate
+#define BINARY_TIMECOURSE 0 // 1 to have replicates write their timecourses straight into timecourse.bin, which is memory-mapped,
+                            // instead of writing fitnessA, protein0_A, gene0_A etc. at the end
+#if AGGREGATE_EXPRESSION && BINARY_TIMECOURSE
+#error "AGGREGATE_EXPRESSION does not keep the timecourses that BINARY_TIMECOURSE writes"
+#endif
 #endif
 
 
@@ -102,7 +157,20 @@
 /*An irregular signal can be specified with an external file that describe the signal (see main.c)*/
 #define IRREG_SIGNAL 0
 #if IRREG_SIGNAL
-float signal_profile_matrix[N_THREADS][100][90];
+/*signal profiles mapped from signal.bin. All threads read the same copy*/
+typedef struct SignalProfiles SignalProfiles;
+struct SignalProfiles
+{
+    int N_profiles;
+    int N_time_points;          /* a profile gives the signal strength at minute 0, 1, ..., N_time_points-1 */
+    float *strength;            /* strength[i*N_time_points+j] is the strength of profile i at minute j */
+    void *mapped_file;
+    size_t mapped_size;
+};
+extern SignalProfiles signal_profiles;
+#endif
+#if MEAN_FIELD_PRESCREEN && IRREG_SIGNAL
+#error "MEAN_FIELD_PRESCREEN does not support IRREG_SIGNAL"
 #endif
 
 
@@ -169,6 +237,22 @@ struct Environment
     float avg_duration_of_burn_in_growth_rate;
 };
 
+/*
+ * SignalSchedule stores when the signal changes in an environment. It is built once per 
+ * environment in calc_avg_fitness, and all replicates read it through the indices in CellState.
+ */
+typedef struct SignalSchedule SignalSchedule;
+struct SignalSchedule
+{
+    int N_signal_off;
+    int N_signal_on;
+    int N_signal_change;
+    float *t_signal_off;        /* times to turn off the signal, relative to the end of burn-in */
+    float *t_signal_on;         /* times to turn on the signal, relative to the end of burn-in */
+    float *t_signal_change;     /* times to change the strength of an external signal (IRREG_SIGNAL).
+                                 * The i-th change sets the signal to external_signal[i+1] */
+};
+
 struct Selection
 {
     Environment env1;
@@ -216,6 +300,7 @@ struct Genotype {
     
     /*these apply to loci*/
     int locus_length[MAX_GENES];                               /* in codon, relates to transcriptional and translational delay */
+    int N_copies[MAX_GENES];                                   /* number of identical copies a gene stands for in a simulation. 1 unless LUMP_IDENTICAL_COPIES */
     int total_loci_length;                                    
     float mRNA_decay_rate[MAX_GENES];                          /* kinetic rates*/
     float protein_decay_rate[MAX_GENES];                       /* kinetic rates*/
@@ -245,7 +330,11 @@ struct Genotype {
     float SE_avg_fitness;
     float SE_fitness1;
     float SE_fitness2;
+    float avg_fitness_diff;                                 /* mean of the paired differences in fitness from the resident (COMMON_RANDOM_NUMBERS only)*/
+    float SE_avg_fitness_diff;
+    float variance_reduction;                               /* variance of the mean fitness under independent sampling divided by that under STRATIFIED_BURN_IN and/or ANTITHETIC_REPLICATES*/
     float fitness_measurement[HI_RESOLUTION_RECALC*N_REPLICATES];
+    int N_fitness_measurements;
     
     /*Motifs related*/
     int N_motifs[36];  
@@ -295,6 +384,13 @@ struct Output_buffer
     float se_avg_f;
     float se_f1;
     float se_f2;
+    float avg_f_diff;
+    float se_avg_f_diff;
+    float variance_reduction;
+    int n_replicates;
+    float mean_field_f;
+    float mean_field_resident_f;
+    int screened_out;
     int n_gene;
     int n_effector_genes;
     int n_act;
@@ -309,6 +405,39 @@ struct Output_buffer
     int n_near_AND_gated_motifs[12];    
 };
 
+/*
+ * residents.bin and mutants.bin (BINARY_OUTPUT) start with the 8 characters "NSRECRD1",
+ * the number of columns and the size of a record (two 4-byte integers), 
+ * followed by an OutputColumn for each column, and then by fixed-width records.
+ */
+typedef struct OutputColumn OutputColumn;
+struct OutputColumn
+{
+    char name[24];      /* name of the field in Output_buffer */
+    char type;          /* 'i' for 4-byte integer, 's' for 2-byte integer, 'f' for 4-byte float, 'c' for char */
+    char unused[3];
+    int count;          /* number of elements */
+    int offset;         /* offset of the column in a record, in bytes */
+};
+
+/*
+ * topology.bin (TOPOLOGY_STREAM) starts with the 8 characters "NSTOPOL2" and MAX_GENES, 
+ * MAX_PROTEINS and N_SIGNAL_TF (4-byte integers). Each network is written as the step 
+ * (4-byte integer) followed by either 'K' and a Topology, or 'D', the number of changed 
+ * bytes of the Topology (2-byte integer), and the offset (2-byte integer) and new value 
+ * (1 byte) of each changed byte.
+ */
+typedef struct Topology Topology;
+struct Topology
+{
+    unsigned char ngenes;
+    unsigned char nproteins;
+    signed char protein_identity[MAX_PROTEINS];
+    unsigned char which_protein[MAX_GENES];
+    unsigned char AND_gate_capable[MAX_GENES];
+    unsigned short N_sites[MAX_GENES][MAX_PROTEINS];   /* binding sites of each protein on each promoter, within the cut-offs of mismatches*/
+};
+
 /*
  * global variables
  */
@@ -141,3 +141,82 @@ float rtsafe(void (*funcd)(float, int, float, float*, float*, float*, float*, fl
 //    fprintf(fperrors,"error in rtsafe: too many iterations\n");
     return 0.0;
 }
+
+/* f(x)-RHS and f'(x) for rtsafe_sum_of_exp. f_inf is sum_i Ns_i-RHS*/
+static inline void sum_of_exp(float x, int n_terms, float f_inf, float *amplitude, float *decay_rate, float *fx, float *dfx)
+{
+    int i;
+    float e;
+    *fx=f_inf;
+    *dfx=0.0;
+    for(i=0;i<n_terms;i++)
+    {
+        e=amplitude[i]*exp(-decay_rate[i]*x);
+        *fx+=e;
+        *dfx-=decay_rate[i]*e;
+    }
+}
+
+/* Same method as rtsafe, but specialized to find x at which 
+ * f(x)=sum_i (N0_i-Ns_i)*exp(-k_i*x)+Ns_i equals RHS, 
+ * where N0, Ns and k are the initial values, the steady states, and the decay rates.
+ * The amplitudes of the exponentials are computed once, and f is not called 
+ * through a function pointer.
+ */
+float rtsafe_sum_of_exp(int n_terms, float RHS, float *initial, float *steady_state, float *decay_rate, float x1, float x2)
+{
+    int i,j;
+    float df,dx,dxold,f,fh,fl,f_inf;
+    float temp,xh,xl,rts;
+    float amplitude[n_terms];
+    
+    f_inf=-RHS;
+    for(i=0;i<n_terms;i++)
+    {
+        amplitude[i]=initial[i]-steady_state[i];
+        f_inf+=steady_state[i];
+    }
+    sum_of_exp(x1, n_terms, f_inf, amplitude, decay_rate, &fl, &df);
+    sum_of_exp(x2, n_terms, f_inf, amplitude, decay_rate, &fh, &df);
+    if (fabs(fl) < 1e-9) return x1;
+    if (fabs(fh) < 1e-9) return x2;
+    if (fl < 0.0) 
+    {
+        xl=x1;
+        xh=x2;
+    } 
+    else 
+    {
+        xh=x1;
+        xl=x2;
+    }
+    rts=0.5*(x1+x2);
+    dxold=fabs(x2-x1);
+    dx=dxold;    
+    sum_of_exp(rts, n_terms, f_inf, amplitude, decay_rate, &f, &df);
+    for (j=1;j<=MAXIT;j++)
+    {
+        if ((((rts-xh)*df-f)*((rts-xl)*df-f) > 0.0) || (fabs(2.0*f) > fabs(dxold*df))) 
+        {
+            dxold=dx;
+            dx=0.5*(xh-xl);
+            rts=xl+dx;      
+            if (xl == rts) return rts;
+        } 
+        else 
+        {
+            dxold=dx;
+            dx=f/df;
+            temp=rts;
+            rts -= dx;
+            if (temp == rts) return rts;
+        }
+        if (fabs(dx) < RT_SAFE_EPSILON) return rts;
+        sum_of_exp(rts, n_terms, f_inf, amplitude, decay_rate, &f, &df);
+        if (f < 0.0) 
+            xl=rts;
+        else 
+            xh=rts;   
+    }
+    return 0.0;
+}
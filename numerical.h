@@ -29,5 +29,8 @@ float expdev(RngStream);
 float rtsafe(void (*funcd)(float, int, float, float*, float*, float*, float*, float*), 
 		    int, float, float *, float*, float*, float, float);
 
+/*Newton-Raphson root-finding method for a sum of exponential decays*/
+float rtsafe_sum_of_exp(int, float, float *, float *, float *, float, float);
+
 #endif
 
@@ -0,0 +1,76 @@
+/*
+ * This file prints all_mutations.txt.gz or fitness_all_mutants.txt.gz,
+ * which are written when COMPRESS_MUTANT_LOGS is 1, as text.
+ *
+ * Usage:
+ *   read_mutant_log all_mutations.txt.gz [step]
+ * Without a step, the whole file is printed (the same as zcat). With a step,
+ * printing starts from the block that holds the mutants tried at the step,
+ * which is found in mutant_log_index.txt in the current directory.
+
+ * Authors: Joanna Masel, Alex Lancaster, Kun Xiong
+ * Copyright (c) 2018 Arizona Board of Regents on behalf of the University of Arizona
+
+ * This file is part of network-evolution-simulator.
+ * network-evolution-simulator is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * network-evolution-simulator is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with network-evolution-simulator. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+
+/*offset of the block that holds the mutants tried at a step*/
+static long find_block(char *file_name, int step)
+{
+    int first_step,N_mutants;
+    long offset_mutations,offset_fitness,offset=0;
+    FILE *fp;
+    fp=fopen("mutant_log_index.txt","r");
+    if(fp==NULL)
+    {
+        printf("Cannot open mutant_log_index.txt! Quit program!\n");
+        exit(-2);
+    }
+    while(fscanf(fp,"%d %d %ld %ld",&first_step,&N_mutants,&offset_mutations,&offset_fitness)==4 && first_step<=step)
+        offset=(strstr(file_name,"fitness_all_mutants")!=NULL)?offset_fitness:offset_mutations;
+    fclose(fp);
+    return offset;
+}
+
+int main(int argc, char *argv[])
+{
+    int fd,N_read;
+    long offset=0;
+    char buffer[65536];
+    gzFile gz;
+
+    if(argc<2)
+    {
+        printf("Usage: %s all_mutations.txt.gz|fitness_all_mutants.txt.gz [step]\n",argv[0]);
+        return -1;
+    }
+    if(argc>2)
+        offset=find_block(argv[1],atoi(argv[2]));
+    fd=open(argv[1],O_RDONLY);
+    if(fd==-1 || lseek(fd,offset,SEEK_SET)!=offset || (gz=gzdopen(fd,"rb"))==NULL)
+    {
+        printf("Cannot read %s! Quit program!\n",argv[1]);
+        return -2;
+    }
+    /*the blocks are gzip members, which gzread reads one after another*/
+    while((N_read=gzread(gz,buffer,sizeof(buffer)))>0)
+        fwrite(buffer,1,N_read,stdout);
+    gzclose(gz);
+    return N_read<0?-2:0;
+}
@@ -0,0 +1,136 @@
+/*
+ * This file renders topology.bin, which is written when TOPOLOGY_STREAM is 1,
+ * in the layout of networks.txt.
+ *
+ * Usage:
+ *   render_topology topology.bin [step]
+ * Without a step, all networks are printed. With a step, only the network
+ * at the step is printed.
+
+ * Authors: Joanna Masel, Alex Lancaster, Kun Xiong
+ * Copyright (c) 2018 Arizona Board of Regents on behalf of the University of Arizona
+
+ * This file is part of network-evolution-simulator.
+ * network-evolution-simulator is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * network-evolution-simulator is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with network-evolution-simulator. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "netsim.h"
+
+/*apply the next network in topology.bin to topology. Returns 0 at the end of the file*/
+static int read_topology(FILE *fp, Topology *topology, int *step)
+{
+    int i;
+    char type;
+    unsigned short N_changes,offset;
+    unsigned char value;
+
+    if(fread(step,sizeof(int),1,fp)!=1 || fread(&type,1,1,fp)!=1)
+        return 0;
+    if(type=='K')
+        return fread(topology,sizeof(Topology),1,fp)==1;
+    if(type!='D' || fread(&N_changes,sizeof(unsigned short),1,fp)!=1)
+        return 0;
+    for(i=0;i<N_changes;i++)
+    {
+        if(fread(&offset,sizeof(unsigned short),1,fp)!=1 || fread(&value,1,1,fp)!=1 || offset>=sizeof(Topology))
+            return 0;
+        ((unsigned char *)topology)[offset]=value;
+    }
+    return 1;
+}
+
+/*the same layout as summarize_binding_sites*/
+static void print_topology(Topology *topology, int step)
+{
+    int i,j;
+    printf("step %d\n",step);
+    printf("Gene     ");
+    for(i=0;i<topology->nproteins-1;i++)
+    {
+        if(topology->protein_identity[i]==ACTIVATOR)
+            printf(" A%d ",i);
+        if(topology->protein_identity[i]==REPRESSOR)
+            printf(" R%d ",i);
+    }
+    printf("which_protein ");
+    printf("AND_gate_capable\n");
+    for(i=N_SIGNAL_TF;i<topology->ngenes;i++)
+    {
+        if(i<10)
+            printf("%d        ",i);
+        else
+            printf("%d       ",i);
+        for(j=0;j<topology->nproteins-1;j++)
+        {
+            if(topology->N_sites[i][j]<10)
+                printf(" %d  ",topology->N_sites[i][j]);
+            else
+                printf(" %d ",topology->N_sites[i][j]);
+        }
+        if(topology->which_protein[i]==topology->nproteins-1)
+            printf("      E  ");
+        else
+        {
+            if(topology->protein_identity[topology->which_protein[i]]==ACTIVATOR)
+                printf("      A");
+            else
+                printf("      R");
+            if(topology->which_protein[i]<10)
+                printf("%d ",topology->which_protein[i]);
+            else
+                printf("%d",topology->which_protein[i]);
+        }
+        if(topology->AND_gate_capable[i])
+            printf("             Y\n");
+        else
+            printf("             N\n");
+    }
+    printf("\n");
+    printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int step,header[3],only_step=-1;
+    char magic[8];
+    Topology topology;
+    FILE *fp;
+
+    if(argc<2)
+    {
+        printf("Usage: %s topology.bin [step]\n",argv[0]);
+        return -1;
+    }
+    if(argc>2)
+        only_step=atoi(argv[2]);
+    fp=fopen(argv[1],"rb");
+    if(fp==NULL || fread(magic,1,8,fp)!=8 || memcmp(magic,"NSTOPOL2",8)!=0 || fread(header,sizeof(int),3,fp)!=3)
+    {
+        printf("Cannot read %s! Quit program!\n",argv[1]);
+        return -2;
+    }
+    if(header[0]!=MAX_GENES || header[1]!=MAX_PROTEINS || header[2]!=N_SIGNAL_TF)
+    {
+        printf("%s was written with MAX_GENES=%d, MAX_PROTEINS=%d and N_SIGNAL_TF=%d. Recompile with them! Quit program!\n",argv[1],header[0],header[1],header[2]);
+        return -2;
+    }
+    memset(&topology,0,sizeof(Topology));
+    while(read_topology(fp,&topology,&step))
+    {
+        if(only_step==-1 || step==only_step)
+            print_topology(&topology,step);
+    }
+    fclose(fp);
+    return 0;
+}